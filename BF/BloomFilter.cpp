@@ -3,8 +3,126 @@
 //
 
 #include "BloomFilter.h"
+#include <cerrno>
 #include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-int get_BF_size(int hashes, int items, float fp) {
-  return ceil(-items * hashes / log(1 - exp(log(fp) / hashes)));
-}
\ No newline at end of file
+using std::string;
+
+long get_BF_size(int hashes, long items, double fp) {
+  return ceil(-static_cast<double>(items) * hashes /
+              log(1 - exp(log(fp) / hashes)));
+}
+
+static constexpr char BF_MAGIC[8] = {'A', 'U', 'R', 'A', 'B', 'F', '0', '2'};
+// files of the releases that sized the GGM tree, and so the deletion filter,
+// from `del_size || ins_size`
+static constexpr char BF_MAGIC_V1[8] = {'A', 'U', 'R', 'A',
+                                        'B', 'F', '0', '1'};
+static_assert(sizeof(BFFileHeader) <= BFFile::HEADER_SIZE);
+
+BFFile::BFFile(const string &path, const BFFileHeader &header, bool read_only)
+    : map_size(HEADER_SIZE + (header.num_of_bits + 63) / 64 * 8),
+      writable(!read_only) {
+  int fd = open(path.c_str(), read_only ? O_RDONLY : O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("cannot open Bloom filter file " + path + ": " +
+                             strerror(errno));
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("cannot stat Bloom filter file " + path + ": " +
+                             strerror(errno));
+  }
+  fresh = st.st_size == 0;
+  char magic[sizeof(BF_MAGIC)];
+  if (!fresh) {
+    const char *problem = nullptr;
+    if (pread(fd, magic, sizeof(magic), 0) !=
+        static_cast<ssize_t>(sizeof(magic))) {
+      problem = " is not a Bloom filter file";
+    } else if (memcmp(magic, BF_MAGIC_V1, sizeof(magic)) == 0) {
+      problem = " was written for a GGM tree of the old size, re-index the "
+                "database";
+    } else if (memcmp(magic, BF_MAGIC, sizeof(magic)) != 0) {
+      problem = " is not a Bloom filter file";
+    }
+    if (problem) {
+      close(fd);
+      throw std::runtime_error("Bloom filter file " + path + problem);
+    }
+  }
+  if ((fresh && read_only) ||
+      (!fresh && static_cast<size_t>(st.st_size) != map_size)) {
+    close(fd);
+    throw std::runtime_error("Bloom filter file " + path +
+                             " does not hold a filter of this size");
+  }
+  if (fresh && ftruncate(fd, static_cast<off_t>(map_size)) != 0) {
+    close(fd);
+    throw std::runtime_error("cannot resize Bloom filter file " + path +
+                             ": " + strerror(errno));
+  }
+  void *addr = mmap(nullptr, map_size,
+                    read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error("cannot map Bloom filter file " + path + ": " +
+                             strerror(errno));
+  }
+  map = static_cast<uint8_t *>(addr);
+  if (fresh) {
+    // the new file is all zero, the header makes it a valid empty filter
+    BFFileHeader written = header;
+    memcpy(written.magic, BF_MAGIC, sizeof(BF_MAGIC));
+    memcpy(map, &written, sizeof(written));
+    touch();
+    sync();
+    return;
+  }
+  BFFileHeader stored;
+  memcpy(&stored, map, sizeof(stored));
+  const char *problem = nullptr;
+  if (stored.num_of_bits != header.num_of_bits ||
+             stored.key_len != header.key_len ||
+             stored.num_of_hashes != header.num_of_hashes ||
+             stored.index != header.index) {
+    problem = " holds a filter with different parameters";
+  } else if (stored.checksum != SpookyHash::Hash64(words(),
+                                                   map_size - HEADER_SIZE,
+                                                   0)) {
+    problem = " fails its checksum, it is corrupt or was not synced";
+  }
+  if (problem) {
+    munmap(map, map_size);
+    map = nullptr;
+    throw std::runtime_error("Bloom filter file " + path + problem);
+  }
+}
+
+BFFile::~BFFile() {
+  if (map) {
+    if (writable) {
+      sync();
+    }
+    munmap(map, map_size);
+  }
+}
+
+void BFFile::sync() {
+  if (!dirty) {
+    return;
+  }
+  // persist the words before the checksum that vouches for them
+  msync(map, map_size, MS_SYNC);
+  uint64_t checksum = SpookyHash::Hash64(words(), map_size - HEADER_SIZE, 0);
+  memcpy(map + offsetof(BFFileHeader, checksum), &checksum, sizeof(checksum));
+  msync(map, HEADER_SIZE, MS_SYNC);
+  dirty = false;
+}
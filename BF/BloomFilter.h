@@ -2,53 +2,271 @@
 #define AURA_BLOOMFILTER_H
 
 #include "Hash/SpookyV2.h"
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
-int get_BF_size(int hashes, int items, float fp);
+// bits for items entries at false positive rate fp, which may exceed 2^31
+long get_BF_size(int hashes, long items, double fp);
+
+// How a BloomFilter maps a key to its positions. The positions of delete_bf
+// are GGM leaves, so the value is sent to the server in init_handler and
+// existing databases keep the mapping they were created with.
+enum class BFIndex : uint8_t {
+  SEEDED = 0,      // Hash64 seeded with i for position i, reduced with %
+  DOUBLE_HASH = 1, // h1 + i * (h2 | 1) from one Hash128, reduced by multiply-shift
+};
+
+// x scaled into [0, n) by a multiply-shift, the high word of x * n
+inline uint64_t fastrange(uint64_t x, uint64_t n) {
+  __extension__ typedef unsigned __int128 uint128;
+  return static_cast<uint64_t>((static_cast<uint128>(x) * n) >> 64);
+}
+
+// The header of a Bloom filter file, padded to BFFile::HEADER_SIZE bytes and
+// followed by the bit words in native byte order. The checksum covers the
+// words and is rewritten by a sync after updates. For the deletion filter
+// num_of_bits is the size of the GGM tree, so a file is only accepted by a
+// tree of the size it was written for.
+struct BFFileHeader {
+  char magic[8];
+  int64_t num_of_bits;
+  uint32_t key_len;
+  uint32_t num_of_hashes;
+  uint8_t index; // BFIndex
+  uint8_t reserved[7];
+  uint64_t checksum;
+};
+
+// The bit words of a BloomFilter kept in a file mapped into memory, so a
+// filter is loaded without parsing and can be shared read-only between
+// processes.
+class BFFile {
+private:
+  uint8_t *map = nullptr;
+  size_t map_size = 0;
+  bool writable;
+  bool fresh = false;
+  // words updated since the last sync
+  bool dirty = false;
+
+public:
+  static constexpr size_t HEADER_SIZE = 64;
+
+  // Map the filter file at path, which must hold a filter with the size,
+  // key length, hashes and index of header and a matching checksum. A
+  // missing or empty file is created with every bit 0 unless read_only.
+  // Throws std::runtime_error when the file cannot be used.
+  BFFile(const std::string &path, const BFFileHeader &header, bool read_only);
+  // syncs a writable file
+  ~BFFile();
+  BFFile(const BFFile &) = delete;
+  BFFile &operator=(const BFFile &) = delete;
+
+  uint64_t *words() const {
+    return reinterpret_cast<uint64_t *>(map + HEADER_SIZE);
+  }
+  bool read_only() const { return !writable; }
+  // true when the constructor created the file
+  bool created() const { return fresh; }
+  // the words are about to change, the next sync has to write them
+  void touch() { dirty = true; }
+
+  // write the words to disk, then the header with their checksum, if they
+  // changed since the last sync
+  void sync();
+};
 
 template <size_t key_len, size_t num_of_hashes> class BloomFilter {
 private:
   long num_of_bits{};
-  std::vector<bool> bits;
+  size_t num_words;
+  // bit i is bit i % 64 of words[i / 64], the bits past num_of_bits are 0.
+  // The words are in storage until map_file moves them into file.
+  std::vector<uint64_t> storage;
+  std::unique_ptr<BFFile> file;
+  uint64_t *words;
+  BFIndex index_mode;
+
+  void begin_update() {
+    if (file) {
+      if (file->read_only()) {
+        throw std::runtime_error("Bloom filter is mapped read-only");
+      }
+      file->touch();
+    }
+  }
+
+  // keys per group of the batch calls, enough misses in flight to cover the
+  // memory latency while the positions of a group stay in L1
+  static constexpr size_t BATCH = 16;
+
+  // the positions of a group of keys, with a prefetch for each of them
+  template <int rw>
+  void prefetch_group(
+      const uint8_t *keys, size_t group,
+      std::array<std::array<long, num_of_hashes>, BATCH> &indexes) const {
+    for (size_t j = 0; j < group; ++j) {
+      indexes[j] = get_index(keys + j * key_len, num_of_bits, index_mode);
+      for (long index : indexes[j]) {
+        __builtin_prefetch(&words[index / 64], rw);
+      }
+    }
+  }
 
 public:
-  explicit BloomFilter(long size) : num_of_bits(size), bits(size, false) {}
+  explicit BloomFilter(long size, BFIndex index = BFIndex::SEEDED)
+      : num_of_bits(size), num_words((size + 63) / 64),
+        storage(num_words, 0), words(storage.data()), index_mode(index) {}
+  BloomFilter(const BloomFilter &) = delete;
+  BloomFilter &operator=(const BloomFilter &) = delete;
 
-  void add_tag(uint8_t *key) {
-    for (size_t i = 0; i < num_of_hashes; ++i) {
-      long index = SpookyHash::Hash64(key, key_len, i) % num_of_bits;
-      bits[index] = true;
+  // Keep the bits in the filter file at path from now on. A file written
+  // for this filter replaces the bits in memory, a new file receives them.
+  // Updates go straight to the mapping and reach the disk with sync. A
+  // read_only filter must not be updated. Throws std::runtime_error when
+  // the file belongs to a different filter or fails its checksum.
+  void map_file(const std::string &path, bool read_only = false) {
+    BFFileHeader header{};
+    header.num_of_bits = num_of_bits;
+    header.key_len = key_len;
+    header.num_of_hashes = num_of_hashes;
+    header.index = static_cast<uint8_t>(index_mode);
+    auto mapped = std::make_unique<BFFile>(path, header, read_only);
+    if (mapped->created()) {
+      std::copy_n(words, num_words, mapped->words());
+      mapped->touch();
+      mapped->sync();
     }
+    file = std::move(mapped);
+    words = file->words();
+    storage = std::vector<uint64_t>();
   }
 
-  bool might_contain(uint8_t *key) {
+  // flush the bits of a mapped filter to its file if they changed, nothing
+  // in memory
+  void sync() {
+    if (file && !file->read_only()) {
+      file->sync();
+    }
+  }
+
+  void add_tag(const uint8_t *key) {
+    begin_update();
+    for (long index : get_index(key, num_of_bits, index_mode)) {
+      words[index / 64] |= 1ULL << (index % 64);
+    }
+  }
+
+  bool might_contain(const uint8_t *key) const {
     bool flag = true;
-    for (size_t i = 0; i < num_of_hashes; ++i) {
-      long index = SpookyHash::Hash64(key, key_len, i) % num_of_bits;
-      flag &= bits[index];
+    for (long index : get_index(key, num_of_bits, index_mode)) {
+      flag &= (words[index / 64] >> (index % 64)) & 1;
     }
     return flag;
   }
 
-  void reset() { bits.clear(); }
+  // add_tag for count keys of key_len bytes stored back to back. The keys
+  // are hashed a group at a time and every word they touch is prefetched
+  // before the first one is written, so the cache misses of a group overlap.
+  void add_tag_batch(const uint8_t *keys, size_t count) {
+    begin_update();
+    std::array<std::array<long, num_of_hashes>, BATCH> indexes;
+    for (size_t first = 0; first < count; first += BATCH) {
+      size_t group = std::min(BATCH, count - first);
+      prefetch_group<1>(keys + first * key_len, group, indexes);
+      for (size_t j = 0; j < group; ++j) {
+        for (long index : indexes[j]) {
+          words[index / 64] |= 1ULL << (index % 64);
+        }
+      }
+    }
+  }
+
+  // might_contain for count keys stored back to back, results[i] for key i
+  void might_contain_batch(const uint8_t *keys, size_t count,
+                           bool *results) const {
+    std::array<std::array<long, num_of_hashes>, BATCH> indexes;
+    for (size_t first = 0; first < count; first += BATCH) {
+      size_t group = std::min(BATCH, count - first);
+      prefetch_group<0>(keys + first * key_len, group, indexes);
+      for (size_t j = 0; j < group; ++j) {
+        bool flag = true;
+        for (long index : indexes[j]) {
+          flag &= (words[index / 64] >> (index % 64)) & 1;
+        }
+        results[first + j] = flag;
+      }
+    }
+  }
 
-  std::array<long, num_of_hashes> static get_index(uint8_t *key,
-                                                   int num_of_bits) {
+  void reset() {
+    begin_update();
+    std::fill_n(words, num_words, 0);
+  }
+
+  BFIndex get_index_mode() const { return index_mode; }
+
+  // the bitset, (num_of_bits + 63) / 64 words laid out as above
+  const uint64_t *get_words() const { return words; }
+
+  // number of positions whose bit equals value
+  long count(bool value = true) const {
+    long ones = 0;
+    for (size_t w = 0; w < num_words; ++w) {
+      ones += std::popcount(words[w]);
+    }
+    return value ? ones : num_of_bits - ones;
+  }
+
+  // first position >= pos whose bit equals value, num_of_bits if none
+  long next_position(long pos, bool value = true) const {
+    if (pos >= num_of_bits)
+      return num_of_bits;
+    uint64_t flip = value ? 0 : ~0ULL;
+    size_t w = pos / 64;
+    uint64_t word = (words[w] ^ flip) & (~0ULL << (pos % 64));
+    while (word == 0) {
+      if (++w == num_words)
+        return num_of_bits;
+      word = words[w] ^ flip;
+    }
+    return std::min(num_of_bits,
+                    static_cast<long>(w * 64 + std::countr_zero(word)));
+  }
+
+  std::array<long, num_of_hashes> static get_index(
+      const uint8_t *key, long num_of_bits, BFIndex index = BFIndex::SEEDED) {
     std::array<long, num_of_hashes> indexes;
+    if (index == BFIndex::DOUBLE_HASH) {
+      // Kirsch-Mitzenmacher: k positions from the two halves of one hash,
+      // the step made odd so that h2 = 0 cannot collapse them into one
+      uint64_t h1 = 0, h2 = 0;
+      SpookyHash::Hash128(key, key_len, &h1, &h2);
+      h2 |= 1;
+      for (size_t i = 0; i < num_of_hashes; ++i) {
+        indexes[i] = fastrange(h1 + i * h2, num_of_bits);
+      }
+      return indexes;
+    }
     for (size_t i = 0; i < num_of_hashes; ++i) {
-      long index = SpookyHash::Hash64(key, key_len, i) % num_of_bits;
-      indexes[i] = index;
+      indexes[i] = SpookyHash::Hash64(key, key_len, i) % num_of_bits;
     }
     return indexes;
   }
 
-  std::vector<long> search(bool value = true) {
+  std::vector<long> search(bool value = true) const {
     std::vector<long> indexes;
-    for (long i = 0; i < num_of_bits; ++i) {
-      if (bits[i] == value) {
-        indexes.emplace_back(i);
-      }
+    indexes.reserve(count(value));
+    for (long pos = next_position(0, value); pos < num_of_bits;
+         pos = next_position(pos + 1, value)) {
+      indexes.emplace_back(pos);
     }
     return indexes;
   }
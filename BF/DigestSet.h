@@ -0,0 +1,111 @@
+#ifndef AURA_DIGESTSET_H
+#define AURA_DIGESTSET_H
+
+#include "Hash/SpookyV2.h"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Exact set of 16-byte digests in one open-addressing table with linear
+// probing. A digest is uniform already, so its low word picks the slot and
+// a lookup is a single probe unless slots collide. Unlike a Bloom filter it
+// answers without false positives, up to a collision of the 128-bit digest.
+class DigestSet {
+public:
+  static constexpr size_t DIGEST_LEN = 16;
+
+  // 128-bit SpookyHash of data, the key of the set
+  static void digest(const void *data, size_t len, uint8_t *out) {
+    uint64_t h1 = 0, h2 = 0;
+    SpookyHash::Hash128(data, len, &h1, &h2);
+    memcpy(out, &h1, sizeof(h1));
+    memcpy(out + sizeof(h1), &h2, sizeof(h2));
+  }
+
+  // empty the set with room for expected digests at a load of at most one
+  // half, keeping the allocation when it is large enough
+  void reset(size_t expected) {
+    size_t capacity = std::bit_ceil(std::max<size_t>(16, 2 * expected));
+    slots.assign(capacity, Slot{});
+    mask = capacity - 1;
+    count = 0;
+    has_zero = false;
+  }
+
+  void insert(const uint8_t *digest) {
+    Slot key = load(digest);
+    if (key.is_empty()) {
+      has_zero = true;
+      return;
+    }
+    if (2 * (count + 1) > slots.size()) {
+      grow();
+    }
+    for (size_t i = key.lo & mask;; i = (i + 1) & mask) {
+      if (slots[i].is_empty()) {
+        slots[i] = key;
+        ++count;
+        return;
+      }
+      if (slots[i] == key)
+        return;
+    }
+  }
+
+  bool contains(const uint8_t *digest) const {
+    Slot key = load(digest);
+    if (key.is_empty())
+      return has_zero;
+    if (slots.empty())
+      return false;
+    for (size_t i = key.lo & mask;; i = (i + 1) & mask) {
+      if (slots[i] == key)
+        return true;
+      if (slots[i].is_empty())
+        return false;
+    }
+  }
+
+  size_t size() const { return count + has_zero; }
+
+private:
+  // the all-zero digest marks an empty slot and is tracked by has_zero
+  struct Slot {
+    uint64_t lo = 0, hi = 0;
+    bool is_empty() const { return (lo | hi) == 0; }
+    bool operator==(const Slot &other) const = default;
+  };
+
+  std::vector<Slot> slots;
+  size_t mask = 0;
+  size_t count = 0;
+  bool has_zero = false;
+
+  static Slot load(const uint8_t *digest) {
+    Slot key;
+    memcpy(&key.lo, digest, sizeof(key.lo));
+    memcpy(&key.hi, digest + sizeof(key.lo), sizeof(key.hi));
+    return key;
+  }
+
+  void grow() {
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.assign(std::max<size_t>(16, 2 * old.size()), Slot{});
+    mask = slots.size() - 1;
+    for (const Slot &key : old) {
+      if (key.is_empty())
+        continue;
+      size_t i = key.lo & mask;
+      while (!slots[i].is_empty()) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = key;
+    }
+  }
+};
+
+#endif // AURA_DIGESTSET_H
@@ -0,0 +1,154 @@
+#ifndef AURA_LABELTABLE_H
+#define AURA_LABELTABLE_H
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+// The entries of a database by their 32-byte label, in one open-addressing
+// table. Slots come in groups of 16 with one control byte each, 7 bits of
+// the label for a full slot or EMPTY, and a lookup compares the control
+// bytes of a group with one vector compare before it touches any label.
+// Labels are PRF outputs, so their first word serves as the hash. The tag
+// of an entry and the place of its ciphertexts sit in its slot. Entries are
+// never removed, a label that is added again keeps its slot.
+class LabelTable {
+public:
+  static constexpr size_t LABEL_LEN = 32;
+  static constexpr size_t TAG_LEN = 32;
+
+  struct Entry {
+    uint8_t label[LABEL_LEN];
+    uint8_t tag[TAG_LEN];
+    // count ciphertexts of length bytes each, back to back in record
+    // number record of the slab numbered slab
+    uint32_t record;
+    uint16_t length;
+    uint8_t count;
+    uint8_t slab;
+  };
+
+  // room for entries entries before the table grows
+  void reserve(size_t entries) {
+    size_t groups = std::bit_ceil((entries * 8 / 7 + GROUP) / GROUP);
+    if (groups * GROUP > ctrl.size()) {
+      rehash(groups);
+    }
+  }
+
+  // the entry of label, nullptr if there is none
+  const Entry *find(const uint8_t *label) const {
+    if (count == 0)
+      return nullptr;
+    uint64_t hash = load_hash(label);
+    int8_t fingerprint = static_cast<int8_t>(hash & 0x7f);
+    for (size_t g = (hash >> 7) & group_mask, step = 1;;
+         g = (g + step++) & group_mask) {
+      const int8_t *group = ctrl.data() + g * GROUP;
+      for (uint32_t match = match_byte(group, fingerprint); match != 0;
+           match &= match - 1) {
+        const Entry &entry = slots[g * GROUP + std::countr_zero(match)];
+        if (memcmp(entry.label, label, LABEL_LEN) == 0)
+          return &entry;
+      }
+      if (match_byte(group, EMPTY) != 0)
+        return nullptr;
+    }
+  }
+
+  // the entry of label, added with everything else zero when missing;
+  // inserted tells which
+  Entry &insert(const uint8_t *label, bool &inserted) {
+    if (8 * (count + 1) > 7 * ctrl.size()) {
+      rehash(std::max<size_t>(1, 2 * (group_mask + 1)));
+    }
+    uint64_t hash = load_hash(label);
+    int8_t fingerprint = static_cast<int8_t>(hash & 0x7f);
+    for (size_t g = (hash >> 7) & group_mask, step = 1;;
+         g = (g + step++) & group_mask) {
+      int8_t *group = ctrl.data() + g * GROUP;
+      for (uint32_t match = match_byte(group, fingerprint); match != 0;
+           match &= match - 1) {
+        Entry &entry = slots[g * GROUP + std::countr_zero(match)];
+        if (memcmp(entry.label, label, LABEL_LEN) == 0) {
+          inserted = false;
+          return entry;
+        }
+      }
+      uint32_t empty = match_byte(group, EMPTY);
+      if (empty != 0) {
+        size_t slot = g * GROUP + std::countr_zero(empty);
+        ctrl[slot] = fingerprint;
+        Entry &entry = slots[slot];
+        memcpy(entry.label, label, LABEL_LEN);
+        ++count;
+        inserted = true;
+        return entry;
+      }
+    }
+  }
+
+  size_t size() const { return count; }
+
+private:
+  static constexpr size_t GROUP = 16;
+  static constexpr int8_t EMPTY = -128;
+
+  std::vector<int8_t> ctrl; // GROUP bytes per group
+  std::vector<Entry> slots;
+  size_t group_mask = 0;
+  size_t count = 0;
+
+  static uint64_t load_hash(const uint8_t *label) {
+    uint64_t hash;
+    memcpy(&hash, label, sizeof(hash));
+    return hash;
+  }
+
+  // bit i set when control byte i of group equals value
+  static uint32_t match_byte(const int8_t *group, int8_t value) {
+#if defined(__x86_64__) && defined(__GNUC__)
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(value)));
+#else
+    uint32_t match = 0;
+    for (size_t i = 0; i < GROUP; ++i) {
+      match |= static_cast<uint32_t>(group[i] == value) << i;
+    }
+    return match;
+#endif
+  }
+
+  // move every entry into a table of groups groups, a power of two
+  void rehash(size_t groups) {
+    std::vector<int8_t> old_ctrl(groups * GROUP, EMPTY);
+    std::vector<Entry> old_slots(groups * GROUP);
+    old_ctrl.swap(ctrl);
+    old_slots.swap(slots);
+    group_mask = groups - 1;
+    for (size_t i = 0; i < old_ctrl.size(); ++i) {
+      if (old_ctrl[i] == EMPTY)
+        continue;
+      uint64_t hash = load_hash(old_slots[i].label);
+      for (size_t g = (hash >> 7) & group_mask, step = 1;;
+           g = (g + step++) & group_mask) {
+        uint32_t empty = match_byte(ctrl.data() + g * GROUP, EMPTY);
+        if (empty != 0) {
+          size_t slot = g * GROUP + std::countr_zero(empty);
+          ctrl[slot] = old_ctrl[i];
+          slots[slot] = old_slots[i];
+          break;
+        }
+      }
+    }
+  }
+};
+
+#endif // AURA_LABELTABLE_H
@@ -0,0 +1,88 @@
+#ifndef AURA_RECORDSLAB_H
+#define AURA_RECORDSLAB_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <vector>
+
+// Append-only store of records of one fixed size, addressed by a 32-bit
+// record number. Records are packed into 2 MiB chunks that are never moved,
+// so a record stays where it was written and the records appended one after
+// the other are adjacent in memory. Chunks may be backed by transparent huge
+// pages, one TLB entry per chunk.
+class RecordSlab {
+public:
+  static constexpr size_t CHUNK_SIZE = 2 << 20;
+
+  RecordSlab(size_t record_size, bool huge_pages)
+      : width(record_size), huge(huge_pages),
+        per_chunk(std::max<size_t>(1, CHUNK_SIZE / record_size)),
+        chunk_bytes((per_chunk * record_size + CHUNK_SIZE - 1) / CHUNK_SIZE *
+                    CHUNK_SIZE) {}
+
+  // room for a new record, its number in index
+  uint8_t *append(uint32_t &index) {
+    if (count == UINT32_MAX) {
+      throw std::runtime_error("record slab is full");
+    }
+    if (count == chunks.size() * per_chunk) {
+      add_chunk();
+    }
+    index = static_cast<uint32_t>(count++);
+    return record(index);
+  }
+
+  // allocate the chunks of the next records records up front, so that
+  // appending them cannot fail. False when they would not all be numbered.
+  bool reserve(size_t records) {
+    if (records > UINT32_MAX - count)
+      return false;
+    while (chunks.size() * per_chunk < count + records) {
+      add_chunk();
+    }
+    return true;
+  }
+
+  uint8_t *record(uint32_t index) {
+    return chunks[index / per_chunk].get() + index % per_chunk * width;
+  }
+  const uint8_t *record(uint32_t index) const {
+    return chunks[index / per_chunk].get() + index % per_chunk * width;
+  }
+
+  size_t record_size() const { return width; }
+  size_t size() const { return count; }
+
+private:
+  struct FreeChunk {
+    void operator()(uint8_t *chunk) const { std::free(chunk); }
+  };
+
+  size_t width;
+  bool huge;
+  size_t per_chunk; // records in a chunk, none straddles two
+  size_t chunk_bytes;
+  size_t count = 0;
+  std::vector<std::unique_ptr<uint8_t, FreeChunk>> chunks;
+
+  void add_chunk() {
+    void *chunk = std::aligned_alloc(CHUNK_SIZE, chunk_bytes);
+    if (chunk == nullptr) {
+      throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge) {
+      madvise(chunk, chunk_bytes, MADV_HUGEPAGE); // advice only
+    }
+#endif
+    chunks.emplace_back(static_cast<uint8_t *>(chunk));
+  }
+};
+
+#endif // AURA_RECORDSLAB_H
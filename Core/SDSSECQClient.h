@@ -3,6 +3,8 @@
 
 #include <PBC.h>
 
+#include "CryptoSuite.h"
+#include "DigestSet.h"
 #include "SSEClientHandler.h"
 
 class SDSSECQClient {
@@ -14,6 +16,11 @@ private:
   uint8_t *K_Z = (unsigned char *)"9876543210123456";
   uint8_t *iv = (unsigned char *)"9876543210123456";
 
+  // PRF states keyed once with the keys above
+  CryptoSuite::prf_key K_X_state{};
+  CryptoSuite::prf_key K_I_state{};
+  CryptoSuite::prf_key K_Z_state{};
+
   // pairing and GT element
   std::unique_ptr<PBC::Pairing> e;
   std::unique_ptr<PBC::GT> g;
@@ -26,11 +33,18 @@ private:
   // state map
   std::unordered_map<std::string, int> CT;
 
-  PBC::Zr Fp(uint8_t *input, size_t input_size, uint8_t *key);
+  // xtag digests of a conjunctive search, one set per xterm, emptied and
+  // reused by the next one
+  std::vector<DigestSet> xtag_sets;
+
+  PBC::Zr Fp(uint8_t *input, size_t input_size,
+             const CryptoSuite::prf_key *key);
 
 public:
-  SDSSECQClient(int ins_size, int del_size, bool init_remote = true);
-  ~SDSSECQClient() { flush(); }
+  SDSSECQClient(int ins_size, int del_size, bool init_remote = true,
+                GGMPrg prg = GGMPrg::KDF,
+                BFIndex bf_index = BFIndex::SEEDED);
+  ~SDSSECQClient();
   void update(UpdateOP op, const std::string &keyword, int ind);
   std::vector<int> search(const std::vector<std::string> &keywords);
 
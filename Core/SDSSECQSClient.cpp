@@ -4,16 +4,20 @@
 using PBC::Zr, PBC::GT, PBC::GPP, PBC::Pairing;
 using std::vector, std::string;
 
-Zr SDSSECQSClient::Fp(uint8_t *input, size_t input_size, uint8_t *key) {
+Zr SDSSECQSClient::Fp(uint8_t *input, size_t input_size,
+                      const CryptoSuite::prf_key *key) {
   uint8_t PRF[DIGEST_SIZE];
-  hmac_digest(input, input_size, key, SM4_BLOCK_SIZE, PRF);
+  CryptoSuite::prf_key_digest(key, input, input_size, PRF);
 
   return Zr(*e, (void *)PRF, DIGEST_SIZE);
 }
 
-SDSSECQSClient::SDSSECQSClient(int ins_size, int del_size, bool init_remote)
-    : TEDB(ins_size, del_size, "tedb", init_remote),
-      XEDB(ins_size, del_size, "xedb", init_remote) {
+SDSSECQSClient::SDSSECQSClient(int ins_size, int del_size, bool init_remote,
+                               GGMPrg prg, BFIndex bf_index)
+    : TEDB(ins_size, del_size, "tedb", init_remote, "127.0.0.1", 5000, prg,
+           bf_index),
+      XEDB(ins_size, del_size, "xedb", init_remote, "127.0.0.1", 5000, prg,
+           bf_index) {
   // generate or load pairing parameters. If pairing.param does not exist,
   // generate default Type A parameters (rbits=160, qbits=512).
   FILE *sysParamFile = fopen("pairing.param", "r");
@@ -54,6 +58,21 @@ SDSSECQSClient::SDSSECQSClient(int ins_size, int del_size, bool init_remote)
     element_out_str(saved_g, 2, const_cast<element_s *>(g->getElement()));
   }
   fclose(saved_g);
+  // key the PRF states once
+  CryptoSuite::prf_key_init(&K_X_state, K_X, SM4_BLOCK_SIZE);
+  CryptoSuite::prf_key_init(&K_x_state, K_x, SM4_BLOCK_SIZE);
+  CryptoSuite::prf_key_init(&K_I_state, K_I, SM4_BLOCK_SIZE);
+  CryptoSuite::prf_key_init(&K_Z_state, K_Z, SM4_BLOCK_SIZE);
+  CryptoSuite::prf_key_init(&K_z_state, K_z, SM4_BLOCK_SIZE);
+}
+
+SDSSECQSClient::~SDSSECQSClient() {
+  flush();
+  CryptoSuite::prf_key_free(&K_X_state);
+  CryptoSuite::prf_key_free(&K_x_state);
+  CryptoSuite::prf_key_free(&K_I_state);
+  CryptoSuite::prf_key_free(&K_Z_state);
+  CryptoSuite::prf_key_free(&K_z_state);
 }
 
 void SDSSECQSClient::update(UpdateOP op, const string &keyword, int ind) {
@@ -69,22 +88,22 @@ void SDSSECQSClient::update(UpdateOP op, const string &keyword, int ind) {
 
   // generate the key for w
   uint8_t K_w[DIGEST_SIZE];
-  hmac_digest((unsigned char *)keyword.c_str(), keyword.size(), K,
-              SM4_BLOCK_SIZE, K_w);
+  CryptoSuite::prf((unsigned char *)keyword.c_str(), keyword.size(), K,
+                   SM4_BLOCK_SIZE, K_w);
 
   // compute TSet values
   // encrypt the id
   uint8_t encrypted_id[SM4_BLOCK_SIZE + sizeof(int)];
   memcpy(encrypted_id, iv, SM4_BLOCK_SIZE);
-  sm4_encrypt((uint8_t *)&ind, sizeof(int), K_w, encrypted_id,
-              encrypted_id + SM4_BLOCK_SIZE);
+  CryptoSuite::encrypt((uint8_t *)&ind, sizeof(int), K_w, encrypted_id,
+                       encrypted_id + SM4_BLOCK_SIZE);
   // compute cross tags (xind=Fp(K_I, ind))
-  Zr xind = Fp((uint8_t *)&ind, sizeof(int), K_I);
+  Zr xind = Fp((uint8_t *)&ind, sizeof(int), &K_I_state);
   // compute z=Fp(K_Z, w||c)
   vector<uint8_t> Z_w(keyword.size() + sizeof(int));
   memcpy(Z_w.data(), keyword.c_str(), keyword.size());
   memcpy(Z_w.data() + keyword.size(), &CT[keyword], sizeof(int));
-  Zr z = Fp(Z_w.data(), Z_w.size(), K_Z);
+  Zr z = Fp(Z_w.data(), Z_w.size(), &K_Z_state);
   // y = xind * z^-1
   Zr y = xind / z;
   // concatenate e, y and c
@@ -102,8 +121,10 @@ void SDSSECQSClient::update(UpdateOP op, const string &keyword, int ind) {
   TEDB.update(op, keyword, ind, eyc.data(), eyc.size());
 
   // generate xterm=g^(Fp(K_X, w)*xind)
-  GT wxtag = (*gpp) ^ (Fp((uint8_t *)keyword.c_str(), keyword.size(), K_X) *
-                       xind / Fp((uint8_t *)Z_w.data(), Z_w.size(), K_x));
+  GT wxtag =
+      (*gpp) ^
+      (Fp((uint8_t *)keyword.c_str(), keyword.size(), &K_X_state) * xind /
+       Fp((uint8_t *)Z_w.data(), Z_w.size(), &K_x_state));
   vector<uint8_t> wxtag_in_byte(
       element_length_in_bytes(const_cast<element_s *>(wxtag.getElement())) +
       sizeof(int));
@@ -149,14 +170,15 @@ SDSSECQSClient::search(const std::vector<std::string> &keywords) {
       memcpy(w_i.data(), sterm.c_str(), sterm.size());
       memcpy(w_i.data() + sterm.size(), &i, sizeof(int));
 
-      Zr z = Fp(w_i.data(), w_i.size(), K_Z);
+      Zr z = Fp(w_i.data(), w_i.size(), &K_Z_state);
 
       std::vector<GT> token_i(xterms.size());
       for (size_t j = 0; j < xterms.size(); ++j) {
         auto &xterm = xterms[j];
         token_i[j] =
-            (*gpp) ^ (z * Fp((uint8_t *)xterm.c_str(), xterm.size(), K_X) *
-                      Fp((uint8_t *)sterm.c_str(), sterm.size(), K_z));
+            (*gpp) ^
+            (z * Fp((uint8_t *)xterm.c_str(), xterm.size(), &K_X_state) *
+             Fp((uint8_t *)sterm.c_str(), sterm.size(), &K_z_state));
       }
       wxtoken_list.emplace_back(std::move(token_i));
     }
@@ -173,8 +195,8 @@ SDSSECQSClient::search(const std::vector<std::string> &keywords) {
         memset(w_j.data(), 0, w_j.size());
         memcpy(w_j.data(), xterm.c_str(), xterm.size());
         memcpy(w_j.data() + xterm.size(), &k, sizeof(int));
-        zx_i[k] = Fp(w_j.data(), w_j.size(), K_x) *
-                  Fp((uint8_t *)sterm.c_str(), sterm.size(), K_z);
+        zx_i[k] = Fp(w_j.data(), w_j.size(), &K_x_state) *
+                  Fp((uint8_t *)sterm.c_str(), sterm.size(), &K_z_state);
       }
       zxtoken_list.emplace_back(std::move(zx_i));
     }
@@ -191,20 +213,31 @@ SDSSECQSClient::search(const std::vector<std::string> &keywords) {
   // ------------------------------------------------------------------
   // 3. Query XEDB
   // ------------------------------------------------------------------
-  int XSET_SIZE = get_BF_size(XSET_HASH, MAX_DB_SIZE, XSET_FP);
-  BloomFilter<128, XSET_HASH> Res_WX(XSET_SIZE);
+  std::vector<std::vector<std::string>> Res_wxtags_list(xterms.size());
   for (size_t j = 0; j < xterms.size(); ++j) {
-    std::vector<std::string> Res_wxtags = XEDB.search(xterms[j]);
-    if (Res_wxtags.empty()) {
+    Res_wxtags_list[j] = XEDB.search(xterms[j]);
+    if (Res_wxtags_list[j].empty()) {
       return res;
     }
-    for (const auto &wxtag_string : Res_wxtags) {
+  }
+  // one exact set of xtag digests per xterm, so that a match of one xterm
+  // cannot stand in for another
+  if (xtag_sets.size() < xterms.size()) {
+    xtag_sets.resize(xterms.size());
+  }
+  std::vector<unsigned char> tag_bytes(g->getElementSize());
+  uint8_t digest[DigestSet::DIGEST_LEN];
+  for (size_t j = 0; j < xterms.size(); ++j) {
+    xtag_sets[j].reset(Res_wxtags_list[j].size());
+    for (const auto &wxtag_string : Res_wxtags_list[j]) {
       GT tag =
           GT(*e, reinterpret_cast<const unsigned char *>(wxtag_string.c_str()),
              128) ^
           zxtoken_list[j][*reinterpret_cast<const int *>(wxtag_string.c_str() +
                                                          128)];
-      Res_WX.add_tag((uint8_t *)tag.toString().c_str());
+      tag.toBytes(tag_bytes.data());
+      DigestSet::digest(tag_bytes.data(), tag_bytes.size(), digest);
+      xtag_sets[j].insert(digest);
     }
   }
 
@@ -219,7 +252,9 @@ SDSSECQSClient::search(const std::vector<std::string> &keywords) {
       GT tag = wxtoken_list[*reinterpret_cast<const int *>(
                    t_tuple.c_str() + SM4_BLOCK_SIZE + sizeof(int) + 20)][j] ^
                y;
-      if (!Res_WX.might_contain((uint8_t *)tag.toString().c_str())) {
+      tag.toBytes(tag_bytes.data());
+      DigestSet::digest(tag_bytes.data(), tag_bytes.size(), digest);
+      if (!xtag_sets[j].contains(digest)) {
         flag = false;
         break;
       }
@@ -233,15 +268,19 @@ SDSSECQSClient::search(const std::vector<std::string> &keywords) {
   // 5. Decrypt results locally
   // ------------------------------------------------------------------
   uint8_t K_w[DIGEST_SIZE];
-  hmac_digest((unsigned char *)sterm.c_str(), sterm.size(), K, SM4_BLOCK_SIZE,
-              K_w);
-
-  for (auto encrypted_res : encrypted_res_list) {
-    int ind;
-    sm4_decrypt(encrypted_res + SM4_BLOCK_SIZE, sizeof(int), K_w, encrypted_res,
-                (uint8_t *)&ind);
-    res.push_back(ind);
+  CryptoSuite::prf((unsigned char *)sterm.c_str(), sterm.size(), K,
+                   SM4_BLOCK_SIZE, K_w);
+
+  res.resize(encrypted_res_list.size());
+  vector<CryptoSuite::batch_item> items(encrypted_res_list.size());
+  for (size_t i = 0; i < encrypted_res_list.size(); ++i) {
+    items[i].input = encrypted_res_list[i] + SM4_BLOCK_SIZE;
+    items[i].input_len = sizeof(int);
+    items[i].key = K_w;
+    items[i].iv = encrypted_res_list[i];
+    items[i].output = reinterpret_cast<uint8_t *>(&res[i]);
   }
+  CryptoSuite::decrypt_batch(items.data(), items.size());
 
   return res;
 }
@@ -3,6 +3,8 @@
 
 #include <PBC.h>
 
+#include "CryptoSuite.h"
+#include "DigestSet.h"
 #include "SSEClientHandler.h"
 
 class SDSSECQSClient {
@@ -20,6 +22,13 @@ private:
   uint8_t *sk_X = (unsigned char *)"0123456789654321";
   uint8_t *iv = (unsigned char *)"9876543210123456";
 
+  // PRF states keyed once with the keys above
+  CryptoSuite::prf_key K_X_state{};
+  CryptoSuite::prf_key K_x_state{};
+  CryptoSuite::prf_key K_I_state{};
+  CryptoSuite::prf_key K_Z_state{};
+  CryptoSuite::prf_key K_z_state{};
+
   // pairing and GT element
   std::unique_ptr<PBC::Pairing> e;
   std::unique_ptr<PBC::GT> g;
@@ -32,11 +41,18 @@ private:
   // state map
   std::unordered_map<std::string, int> CT;
 
-  PBC::Zr Fp(uint8_t *input, size_t input_size, uint8_t *key);
+  // xtag digests of a conjunctive search, one set per xterm, emptied and
+  // reused by the next one
+  std::vector<DigestSet> xtag_sets;
+
+  PBC::Zr Fp(uint8_t *input, size_t input_size,
+             const CryptoSuite::prf_key *key);
 
 public:
-  SDSSECQSClient(int ins_size, int del_size, bool init_remote = true);
-  ~SDSSECQSClient() { flush(); }
+  SDSSECQSClient(int ins_size, int del_size, bool init_remote = true,
+                 GGMPrg prg = GGMPrg::KDF,
+                 BFIndex bf_index = BFIndex::SEEDED);
+  ~SDSSECQSClient();
 
   void update(UpdateOP op, const std::string &keyword, int ind);
   std::vector<int> search(const std::vector<std::string> &keywords);
@@ -47,6 +63,29 @@ public:
     CT = ct_map;
   }
 
+  // Keep the GGM leaf keys of both databases in table files under dir when
+  // each fits in memory_budget bytes, see SSEClientHandler::use_leaf_table.
+  // Returns false when either database derives its keys on demand.
+  bool use_leaf_tables(const std::string &dir, size_t memory_budget) {
+    bool tedb = TEDB.use_leaf_table(dir + "/tedb.ggm", memory_budget);
+    bool xedb = XEDB.use_leaf_table(dir + "/xedb.ggm", memory_budget);
+    return tedb && xedb;
+  }
+
+  // Keep the deletions of both databases in filter files under dir, see
+  // SSEClientHandler::keep_deletions.
+  void keep_deletions(const std::string &dir) {
+    TEDB.keep_deletions(dir + "/tedb.bf");
+    XEDB.keep_deletions(dir + "/xedb.bf");
+  }
+
+  // Derive the search cover keys of both databases on threads threads.
+  void set_threads(unsigned threads) {
+    auto pool = std::make_shared<ThreadPool>(threads);
+    TEDB.set_thread_pool(pool);
+    XEDB.set_thread_pool(pool);
+  }
+
   // Force flush pending insertions to server.
   void flush() {
     TEDB.flush();
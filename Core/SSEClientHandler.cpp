@@ -1,109 +1,121 @@
 #include "SSEClientHandler.h"
 #include "BloomFilter.h"
 #include "CommonUtil.h"
+#include "CryptoSuite.h"
 #include <algorithm>
+#include <array>
 #include <cstring>
-#include <iterator>
+#include <filesystem>
+#include <stdexcept>
 
-using std::string, std::vector, std::set_difference, std::inserter, std::sort;
+using std::string, std::vector, std::sort;
 
-SSEClientHandler::SSEClientHandler(int ins_size, int del_size,
+SSEClientHandler::SSEClientHandler(long ins_size, long del_size,
                                    const std::string &db_id, bool init_remote,
-                                   const std::string &host, uint16_t port)
-    : tree(GGM_SIZE = get_BF_size(HASH_SIZE, del_size || ins_size, GGM_FP)),
-      delete_bf(GGM_SIZE), server(db_id, host, port) {
+                                   const std::string &host, uint16_t port,
+                                   GGMPrg prg, BFIndex bf_index)
+    : GGM_SIZE(get_BF_size(HASH_SIZE, del_size > 0 ? del_size : ins_size,
+                           GGM_FP)),
+      tree(GGM_SIZE, prg), delete_bf(GGM_SIZE, bf_index),
+      fresh_database(init_remote), server(db_id, host, port) {
   if (init_remote) {
-    server.init_handler(GGM_SIZE);
+    server.init_handler(GGM_SIZE, prg, CryptoSuite::name, bf_index,
+                        ins_size);
   }
 }
 
-void SSEClientHandler::update(UpdateOP op, const string &keyword, int ind,
-                              uint8_t *content, size_t content_len) {
-  // compute the tag
-  vector<uint8_t> pair(keyword.size() + sizeof(int));
+bool SSEClientHandler::use_leaf_table(const string &path,
+                                      size_t memory_budget) {
+  if (GGMLeafTable::table_size(GGM_SIZE) > memory_budget) {
+    leaf_table.reset();
+    return false;
+  }
+  leaf_table = std::make_unique<GGMLeafTable>(path, key, GGM_SIZE,
+                                              tree.get_level(), tree.get_prg());
+  return true;
+}
+
+void SSEClientHandler::keep_deletions(const string &path) {
+  // a new database must not take over, or wipe, the deletions of another
+  std::error_code ec;
+  if (fresh_database && std::filesystem::exists(path, ec) &&
+      std::filesystem::file_size(path, ec) > 0) {
+    throw std::runtime_error("deletion filter " + path +
+                             " already exists, remove it to start a new "
+                             "database there");
+  }
+  delete_bf.map_file(path);
+  // the loaded positions are not in the cover yet
+  cover_built = false;
+  cover_packed = false;
+}
+
+// keyword || ind, the input of the tag digest
+static string tag_input(const string &keyword, int ind) {
+  string pair(keyword.size() + sizeof(int), '\0');
   memcpy(pair.data(), keyword.c_str(), keyword.size());
   memcpy(pair.data() + keyword.size(), (uint8_t *)&ind, sizeof(int));
-  // generate the digest of tag
-  vector<uint8_t> tag(DIGEST_SIZE);
-  sm3_digest(pair.data(), pair.size(), tag.data());
-  // process the operator
-  if (op == UpdateOP::INS) {
-    // get all offsets in BF
-    auto indexes = BloomFilter<32, HASH_SIZE>::get_index(tag.data(), GGM_SIZE);
-    sort(indexes.begin(), indexes.end());
+  return pair;
+}
 
-    // get SRE ciphertext list
-    vector<string> ciphertext_list(indexes.size());
-    for (size_t i = 0; i < indexes.size(); ++i) {
-      const auto &index = indexes[i];
-      // derive a key from the offset
-      uint8_t derived_key[SM4_BLOCK_SIZE];
-      memcpy(derived_key, key, SM4_BLOCK_SIZE);
-      GGMTree::derive_key_from_tree(derived_key, index, tree.get_level(), 0);
-      // use the key to encrypt the id
-      vector<uint8_t> encrypted_id(SM4_BLOCK_SIZE + content_len);
-      memcpy(encrypted_id.data(), iv, SM4_BLOCK_SIZE);
-      sm4_encrypt(content, content_len, derived_key, encrypted_id.data(),
-                  encrypted_id.data() + SM4_BLOCK_SIZE);
-      // save the encrypted id in the list
-      ciphertext_list[i] =
-          string((char *)encrypted_id.data(), encrypted_id.size());
-    }
+// digests of a batch of tag inputs, DIGEST_SIZE bytes each
+static vector<uint8_t> compute_tags(const vector<string> &pairs) {
+  vector<const uint8_t *> inputs(pairs.size());
+  vector<int> input_lens(pairs.size());
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    inputs[i] = (const uint8_t *)pairs[i].data();
+    input_lens[i] = static_cast<int>(pairs[i].size());
+  }
+  vector<uint8_t> tags(pairs.size() * DIGEST_SIZE);
+  CryptoSuite::hash_batch(inputs.data(), input_lens.data(), pairs.size(),
+                          tags.data());
+  return tags;
+}
 
-    // token
-    uint8_t token[DIGEST_SIZE];
-    hmac_digest((uint8_t *)keyword.c_str(), keyword.size(), key, SM4_BLOCK_SIZE,
-                token);
-    // label
-    int counter = C[keyword];
-    uint8_t label[DIGEST_SIZE];
-    hmac_digest((uint8_t *)&counter, sizeof(int), token, DIGEST_SIZE, label);
-    C[keyword]++;
-    // convert tag/label to string
-    string tag_str((char *)tag.data(), DIGEST_SIZE);
-    string label_str((char *)label, DIGEST_SIZE);
-    // enqueue entry for batch upload
-    pending_entries.emplace_back(label_str, tag_str, ciphertext_list);
-    if (pending_entries.size() >= BATCH_SIZE) {
+void SSEClientHandler::update(UpdateOP op, const string &keyword, int ind,
+                              uint8_t *content, size_t content_len) {
+  // process the operator
+  if (op == UpdateOP::INS) {
+    // the counter fixes the label now, the crypto runs batched in flush_batch
+    pending_inserts.push_back({keyword, ind, C[keyword]++,
+                               string((char *)content, content_len)});
+    if (pending_inserts.size() >= BATCH_SIZE) {
       flush_batch();
     }
   } else {
-    // Ensure all pending insertions are committed before deletions
-    flush_batch();
-    // insert the tag into BF
-    delete_bf.add_tag(tag.data());
+    // deletions only touch the local filter, their tags are hashed in batches
+    // before the next search
+    pending_deletes.emplace_back(tag_input(keyword, ind));
+    if (pending_deletes.size() >= BATCH_SIZE) {
+      apply_deletes();
+    }
   }
 }
 
 vector<string> SSEClientHandler::search(const string &keyword) {
-  // Commit any pending entries before searching
+  // Commit any pending entries before searching, the filter file is synced
+  // by the next flush
   flush_batch();
+  apply_deletes();
   // token
   //    cout <<
   //    duration_cast<microseconds>(system_clock::now().time_since_epoch()).count()
   //    << endl;
   uint8_t token[DIGEST_SIZE];
-  hmac_digest((uint8_t *)keyword.c_str(), keyword.size(), key, SM4_BLOCK_SIZE,
-              token);
-  // search all deleted positions
-  vector<long> bf_pos(GGM_SIZE);
-  for (size_t i = 0; i < bf_pos.size(); ++i) {
-    bf_pos[i] = i;
-  }
-  vector<long> delete_pos = delete_bf.search();
-  vector<long> remain_pos;
-  set_difference(bf_pos.begin(), bf_pos.end(), delete_pos.begin(),
-                 delete_pos.end(), inserter(remain_pos, remain_pos.begin()));
-  // generate GGM Node for the remain position
-  vector<GGMNode> node_list(remain_pos.size());
-  for (size_t i = 0; i < remain_pos.size(); ++i) {
-    node_list[i] = GGMNode(remain_pos[i], tree.get_level());
-  }
-  vector<GGMNode> remain_node = tree.min_coverage(node_list);
-  // compute the key set and send to the server
-  for (auto &i : remain_node) {
-    memcpy(i.key, key, SM4_BLOCK_SIZE);
-    GGMTree::derive_key_from_tree(i.key, i.index, i.level, 0);
+  CryptoSuite::prf((uint8_t *)keyword.c_str(), keyword.size(), key,
+                   SM4_BLOCK_SIZE, token);
+  // the cover only changes with deletions, reuse it as long as it holds
+  if (!cover_built) {
+    build_cover();
+  }
+  if (!cover_packed) {
+    vector<GGMNode> nodes;
+    nodes.reserve(cover.size());
+    for (const auto &[first_leaf, node] : cover) {
+      nodes.emplace_back(node);
+    }
+    packed_cover = GGMCover::pack(nodes, tree.get_level());
+    cover_packed = true;
   }
   // give all results to the server for search
   //    cout <<
@@ -111,7 +123,7 @@ vector<string> SSEClientHandler::search(const string &keyword) {
   //    << endl;
   std::string token_str(reinterpret_cast<char *>(token), DIGEST_SIZE);
   vector<string> res;
-  if (!server.search(token_str, remain_node, tree.get_level(), res)) {
+  if (!server.search_packed(token_str, packed_cover, tree.get_level(), res)) {
     return {};
   }
   //    cout <<
@@ -120,9 +132,176 @@ vector<string> SSEClientHandler::search(const string &keyword) {
   return res;
 }
 
+void SSEClientHandler::build_cover() {
+  // the live positions are the clear bits of delete_bf, cover them with as
+  // few GGM nodes as possible straight from its words
+  vector<GGMNode> remain_node;
+  tree.min_coverage(delete_bf.get_words(), GGM_SIZE, remain_node, false);
+  // compute the key set
+  vector<uint8_t *> key_ptrs(remain_node.size());
+  vector<long> offsets(remain_node.size());
+  vector<int> levels(remain_node.size());
+  for (size_t i = 0; i < remain_node.size(); ++i) {
+    memcpy(remain_node[i].key, key, SM4_BLOCK_SIZE);
+    key_ptrs[i] = remain_node[i].key;
+    offsets[i] = remain_node[i].index;
+    levels[i] = remain_node[i].level;
+  }
+  auto derive = [&](size_t begin, size_t end) {
+    GGMTree::derive_keys_batch(key_ptrs.data() + begin, offsets.data() + begin,
+                               levels.data() + begin, end - begin,
+                               tree.get_prg());
+  };
+  if (pool) {
+    pool->parallel_for(remain_node.size(), COVER_CHUNK, derive);
+  } else {
+    derive(0, remain_node.size());
+  }
+  cover.clear();
+  for (const GGMNode &node : remain_node) {
+    cover.emplace_hint(cover.end(),
+                       node.index << (tree.get_level() - node.level), node);
+  }
+  cover_built = true;
+  cover_packed = false;
+}
+
+void SSEClientHandler::split_cover(long leaf) {
+  // the cover node whose leaves hold leaf, if it is still live
+  auto it = cover.upper_bound(leaf);
+  if (it == cover.begin())
+    return;
+  --it;
+  int height = tree.get_level() - it->second.level;
+  if (leaf >= it->first + (1L << height))
+    return;
+  vector<GGMNode> siblings;
+  tree.split_node(it->second, leaf, siblings);
+  cover.erase(it);
+  for (const GGMNode &node : siblings) {
+    cover.emplace(node.index << (tree.get_level() - node.level), node);
+  }
+  cover_packed = false;
+}
+
 void SSEClientHandler::flush_batch() {
-  if (pending_entries.empty())
+  if (pending_inserts.empty())
     return;
-  server.add_entries_batch(pending_entries);
-  pending_entries.clear();
-}
\ No newline at end of file
+  size_t count = pending_inserts.size();
+  // compute the tags of all entries
+  vector<string> pairs(count);
+  for (size_t i = 0; i < count; ++i) {
+    pairs[i] = tag_input(pending_inserts[i].keyword, pending_inserts[i].ind);
+  }
+  vector<uint8_t> tags = compute_tags(pairs);
+
+  // get all offsets in BF, each ciphertext is iv || CTR(id)
+  size_t key_count = count * HASH_SIZE;
+  vector<vector<string>> ciphertext_lists(count);
+  vector<long> offsets(key_count);
+  for (size_t i = 0; i < count; ++i) {
+    auto indexes = BloomFilter<32, HASH_SIZE>::get_index(
+        tags.data() + i * DIGEST_SIZE, GGM_SIZE, delete_bf.get_index_mode());
+    sort(indexes.begin(), indexes.end());
+    std::copy(indexes.begin(), indexes.end(), offsets.begin() + i * HASH_SIZE);
+  }
+  // without a leaf table, derive every distinct leaf once, sharing the paths
+  // from the root
+  vector<long> leaves;
+  vector<uint8_t> leaf_keys;
+  if (!leaf_table) {
+    leaves = offsets;
+    sort(leaves.begin(), leaves.end());
+    leaves.erase(std::unique(leaves.begin(), leaves.end()), leaves.end());
+    leaf_keys.resize(leaves.size() * SM4_BLOCK_SIZE);
+    GGMTree::derive_leaf_keys(key, leaves.data(), leaves.size(),
+                              tree.get_level(), leaf_keys.data(),
+                              tree.get_prg());
+  }
+  vector<CryptoSuite::batch_item> items(key_count);
+  for (size_t i = 0; i < count; ++i) {
+    const string &content = pending_inserts[i].content;
+    ciphertext_lists[i].resize(HASH_SIZE);
+    for (size_t j = 0; j < HASH_SIZE; ++j) {
+      long offset = offsets[i * HASH_SIZE + j];
+      const uint8_t *derived_key;
+      if (leaf_table) {
+        derived_key = leaf_table->leaf_key(offset);
+      } else {
+        size_t leaf = std::lower_bound(leaves.begin(), leaves.end(), offset) -
+                      leaves.begin();
+        derived_key = leaf_keys.data() + leaf * SM4_BLOCK_SIZE;
+      }
+      string &ciphertext = ciphertext_lists[i][j];
+      ciphertext.resize(SM4_BLOCK_SIZE + content.size());
+      auto *encrypted_id = (uint8_t *)ciphertext.data();
+      memcpy(encrypted_id, iv, SM4_BLOCK_SIZE);
+      auto &item = items[i * HASH_SIZE + j];
+      item.input = (const uint8_t *)content.data();
+      item.input_len = static_cast<int>(content.size());
+      item.key = derived_key;
+      item.iv = encrypted_id;
+      item.output = encrypted_id + SM4_BLOCK_SIZE;
+    }
+  }
+  // use the keys to encrypt the ids in one batch
+  CryptoSuite::encrypt_batch(items.data(), items.size());
+
+  // label = PRF(token, counter), keyed once per keyword
+  vector<uint8_t> labels(count * DIGEST_SIZE);
+  std::unordered_map<string, vector<size_t>> keyword_entries;
+  for (size_t i = 0; i < count; ++i) {
+    keyword_entries[pending_inserts[i].keyword].push_back(i);
+  }
+  for (const auto &[keyword, entries] : keyword_entries) {
+    uint8_t token[DIGEST_SIZE];
+    CryptoSuite::prf((uint8_t *)keyword.c_str(), keyword.size(), key,
+                     SM4_BLOCK_SIZE, token);
+    CryptoSuite::prf_key label_key;
+    CryptoSuite::prf_key_init(&label_key, token, DIGEST_SIZE);
+    vector<const uint8_t *> inputs(entries.size());
+    vector<int> input_lens(entries.size(), sizeof(int));
+    for (size_t k = 0; k < entries.size(); ++k) {
+      inputs[k] = (const uint8_t *)&pending_inserts[entries[k]].counter;
+    }
+    vector<uint8_t> keyword_labels(entries.size() * DIGEST_SIZE);
+    CryptoSuite::prf_key_digest_batch(&label_key, inputs.data(),
+                                      input_lens.data(), entries.size(),
+                                      keyword_labels.data());
+    CryptoSuite::prf_key_free(&label_key);
+    for (size_t k = 0; k < entries.size(); ++k) {
+      memcpy(labels.data() + entries[k] * DIGEST_SIZE,
+             keyword_labels.data() + k * DIGEST_SIZE, DIGEST_SIZE);
+    }
+  }
+
+  // upload the entries in insertion order
+  vector<std::tuple<string, string, vector<string>>> entries;
+  entries.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    entries.emplace_back(
+        string((char *)labels.data() + i * DIGEST_SIZE, DIGEST_SIZE),
+        string((char *)tags.data() + i * DIGEST_SIZE, DIGEST_SIZE),
+        std::move(ciphertext_lists[i]));
+  }
+  server.add_entries_batch(entries);
+  pending_inserts.clear();
+}
+
+void SSEClientHandler::apply_deletes() {
+  if (pending_deletes.empty())
+    return;
+  // insert the tags into BF, every newly deleted position leaves the cover
+  vector<uint8_t> tags = compute_tags(pending_deletes);
+  if (cover_built) {
+    for (size_t i = 0; i < pending_deletes.size(); ++i) {
+      for (long pos : BloomFilter<32, HASH_SIZE>::get_index(
+               tags.data() + i * DIGEST_SIZE, GGM_SIZE,
+               delete_bf.get_index_mode())) {
+        split_cover(pos);
+      }
+    }
+  }
+  delete_bf.add_tag_batch(tags.data(), pending_deletes.size());
+  pending_deletes.clear();
+}
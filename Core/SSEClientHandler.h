@@ -2,9 +2,13 @@
 #define AURA_SSECLIENTHANDLER_H
 
 #include "BloomFilter.h"
+#include "GGMLeafTable.h"
 #include "GGMTree.h"
 #include "Server/SSEServerClient.h"
+#include "ThreadPool.h"
 #include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <unordered_map>
@@ -17,17 +21,45 @@ private:
   static constexpr unsigned char key[] = "0123456789123456";
   static constexpr unsigned char iv[] = "0123456789123456";
 
+  long GGM_SIZE; // leaves of the GGM tree, may exceed 2^31
   GGMTree tree;
-  int GGM_SIZE;
+  // all leaf keys, when use_leaf_table found room for them
+  std::unique_ptr<GGMLeafTable> leaf_table;
+  // derives the cover keys of a search, null to stay on the calling thread
+  std::shared_ptr<ThreadPool> pool;
+  // smallest number of cover nodes handed to one thread
+  static constexpr size_t COVER_CHUNK = 64;
   BloomFilter<32, HASH_SIZE> delete_bf;
+  // init_remote, the database started empty with this handler
+  bool fresh_database;
   std::unordered_map<std::string, int> C; // search time
 
-  // batching support
+  // the cover of the live leaves with its keys, by first leaf. It depends on
+  // delete_bf only, so it is built by the first search and then every new
+  // deleted position splits the one node above it.
+  std::map<long, GGMNode> cover;
+  bool cover_built = false;
+  // the cover in the packed wire format, repacked after a split
+  std::string packed_cover;
+  bool cover_packed = false;
+
+  // batching support: updates are queued and their tags, labels and
+  // ciphertexts computed together when the queue is flushed
   static constexpr size_t BATCH_SIZE = 8192;
-  std::vector<std::tuple<std::string, std::string, std::vector<std::string>>>
-      pending_entries;
+  struct PendingInsert {
+    std::string keyword;
+    int ind;
+    int counter; // C[keyword] at update time, selects the label
+    std::string content;
+  };
+  std::vector<PendingInsert> pending_inserts;
+  // keyword || ind of deletions not yet added to delete_bf
+  std::vector<std::string> pending_deletes;
 
   void flush_batch();
+  void apply_deletes();
+  void build_cover();
+  void split_cover(long leaf);
 
   SSEServerClient server;
 
@@ -35,16 +67,46 @@ public:
   // If init_remote is true (default), constructor will reset/initialise the
   // corresponding server-side handler. Set it to false when you only want to
   // connect to an existing database without wiping its contents.
-  SSEClientHandler(int ins_size, int del_size, const std::string &db_id,
+  // prg selects the GGM derivation of a new database and bf_index how tags
+  // map to GGM leaves, both must match the ones the database was created
+  // with when init_remote is false.
+  SSEClientHandler(long ins_size, long del_size, const std::string &db_id,
                    bool init_remote = true,
-                   const std::string &host = "127.0.0.1", uint16_t port = 5000);
+                   const std::string &host = "127.0.0.1", uint16_t port = 5000,
+                   GGMPrg prg = GGMPrg::KDF,
+                   BFIndex bf_index = BFIndex::SEEDED);
   ~SSEClientHandler() { flush(); }
   void update(UpdateOP op, const std::string &keyword, int ind,
               uint8_t *content, size_t content_len);
   std::vector<std::string> search(const std::string &keyword);
 
-  // Force commit any pending batched entries to the server immediately.
-  void flush() { flush_batch(); }
+  // Expand every leaf key of the tree into the table file at path (or map it
+  // if an earlier run left it there) when the table fits in memory_budget
+  // bytes, inserts then look leaf keys up instead of deriving them. Returns
+  // false and keeps deriving on demand when the table does not fit.
+  bool use_leaf_table(const std::string &path, size_t memory_budget);
+
+  // Keep the deleted positions in the filter file at path, synced by flush
+  // and when the handler is destroyed, so they survive it. A handler that
+  // initialised the database creates the file, otherwise the file of an
+  // earlier run is loaded; call this before deleting anything. Throws
+  // std::runtime_error when a new database finds the file already there or
+  // the file belongs to a different database.
+  void keep_deletions(const std::string &path);
+
+  // Derive the cover keys of a search on thread_pool, which may be shared
+  // with other handlers. The nodes sent to the server keep their order.
+  void set_thread_pool(std::shared_ptr<ThreadPool> thread_pool) {
+    pool = std::move(thread_pool);
+  }
+
+  // Force commit any pending batched entries to the server immediately,
+  // and sync the deletion filter file.
+  void flush() {
+    flush_batch();
+    apply_deletes();
+    delete_bf.sync();
+  }
 };
 
 #endif // AURA_SSECLIENTHANDLER_H
@@ -1,81 +1,310 @@
 #include "Core/SSEServerHandler.h"
 #include "BloomFilter.h"
+#include "CryptoSuite.h"
 #include "GGMTree.h"
 #include <algorithm>
-#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <tuple>
 #include <vector>
 
 using std::sort, std::vector, std::min, std::string;
 
-SSEServerHandler::SSEServerHandler(int GGM_SIZE) {
+SSEServerHandler::SSEServerHandler(long GGM_SIZE, GGMPrg ggm_prg,
+                                   BFIndex index,
+                                   std::shared_ptr<ThreadPool> thread_pool,
+                                   long capacity, bool use_huge_pages)
+    : huge_pages(use_huge_pages), pool(std::move(thread_pool)) {
   this->GGM_SIZE = GGM_SIZE;
-  tags.clear();
-  dict.clear();
+  this->prg = ggm_prg;
+  this->bf_index = index;
+  if (capacity > 0) {
+    entries.reserve(capacity);
+  }
+}
+
+bool SSEServerHandler::valid_entry(const string &label, const string &tag,
+                                   const vector<string> &ciphertext_list) {
+  static_assert(LabelTable::LABEL_LEN == DIGEST_SIZE &&
+                LabelTable::TAG_LEN == DIGEST_SIZE);
+  if (label.size() != DIGEST_SIZE || tag.size() != DIGEST_SIZE ||
+      ciphertext_list.size() > UINT8_MAX)
+    return false;
+  size_t length =
+      ciphertext_list.empty() ? 0 : ciphertext_list.front().size();
+  return std::all_of(ciphertext_list.begin(), ciphertext_list.end(),
+                     [length](const string &ciphertext) {
+                       return ciphertext.size() == length &&
+                              length >= SM4_BLOCK_SIZE &&
+                              length <= UINT16_MAX;
+                     });
 }
 
-void SSEServerHandler::add_entries(const string &label, const string &tag,
+bool SSEServerHandler::add_entries(const string &label, const string &tag,
                                    vector<string> ciphertext_list) {
-  tags[label] = tag;
-  dict[label] = std::move(ciphertext_list);
+  if (!valid_entry(label, tag, ciphertext_list))
+    return false;
+  size_t length =
+      ciphertext_list.empty() ? 0 : ciphertext_list.front().size();
+  // the slab of records of this size
+  size_t record_size = ciphertext_list.size() * length;
+  size_t slab = find_slab(record_size);
+  if (record_size > 0 && slab == slabs.size()) {
+    if (slabs.size() > UINT8_MAX)
+      return false;
+    slabs.emplace_back(record_size, huge_pages);
+  }
+
+  bool inserted;
+  LabelTable::Entry &entry =
+      entries.insert((const uint8_t *)label.data(), inserted);
+  memcpy(entry.tag, tag.data(), DIGEST_SIZE);
+  // an entry added again is rewritten in place when its size is unchanged
+  bool same_size = !inserted && entry.count * entry.length == record_size &&
+                   entry.slab == slab;
+  entry.count = static_cast<uint8_t>(ciphertext_list.size());
+  entry.length = static_cast<uint16_t>(length);
+  if (record_size == 0)
+    return true;
+  entry.slab = static_cast<uint8_t>(slab);
+  uint8_t *record = same_size ? slabs[slab].record(entry.record)
+                              : slabs[slab].append(entry.record);
+  for (const string &ciphertext : ciphertext_list) {
+    memcpy(record, ciphertext.data(), length);
+    record += length;
+  }
+  return true;
+}
+
+bool SSEServerHandler::add_entries_batch(vector<Entry> &batch) {
+  if (!std::all_of(batch.begin(), batch.end(), [](const Entry &one) {
+        return valid_entry(std::get<0>(one), std::get<1>(one),
+                           std::get<2>(one));
+      })) {
+    return false;
+  }
+  // the records each slab may have to append, new slabs past the end
+  vector<size_t> sizes, appends(slabs.size());
+  for (const Entry &one : batch) {
+    const vector<string> &ciphertext_list = std::get<2>(one);
+    if (ciphertext_list.empty())
+      continue;
+    size_t record_size =
+        ciphertext_list.size() * ciphertext_list.front().size();
+    size_t slab = find_slab(record_size);
+    if (slab == slabs.size()) {
+      slab += std::find(sizes.begin(), sizes.end(), record_size) -
+              sizes.begin();
+      if (slab == slabs.size() + sizes.size()) {
+        sizes.emplace_back(record_size);
+        appends.emplace_back(0);
+      }
+    }
+    ++appends[slab];
+  }
+  if (slabs.size() + sizes.size() > UINT8_MAX + 1)
+    return false;
+  // allocate everything first, so that no entry is added unless all are.
+  // Room reserved in existing slabs and the table is invisible if this
+  // fails half way.
+  vector<RecordSlab> new_slabs;
+  for (size_t record_size : sizes) {
+    new_slabs.emplace_back(record_size, huge_pages);
+  }
+  for (size_t slab = 0; slab < appends.size(); ++slab) {
+    RecordSlab &target = slab < slabs.size() ? slabs[slab]
+                                             : new_slabs[slab - slabs.size()];
+    if (!target.reserve(appends[slab]))
+      return false;
+  }
+  entries.reserve(entries.size() + batch.size());
+  slabs.reserve(slabs.size() + new_slabs.size());
+  std::move(new_slabs.begin(), new_slabs.end(), std::back_inserter(slabs));
+  for (auto &[label, tag, ciphertext_list] : batch) {
+    add_entries(label, tag, std::move(ciphertext_list));
+  }
+  return true;
+}
+
+size_t SSEServerHandler::find_slab(size_t record_size) const {
+  size_t slab = 0;
+  while (slab < slabs.size() && slabs[slab].record_size() != record_size) {
+    ++slab;
+  }
+  return slab;
 }
 
 vector<string> SSEServerHandler::search(uint8_t *token,
                                         const vector<GGMNode> &node_list,
                                         int level) {
-  keys.clear();
-  root_key_map.clear();
-  // pre-search, derive all keys
-  compute_leaf_key_maps(node_list, level);
-  // get the result
+  vector<uint8_t> keys;
+  GGMCover cover;
+  if (!GGMCover::from_nodes(node_list, level, keys, cover))
+    return {};
+  return search(token, cover, level);
+}
+
+vector<string> SSEServerHandler::search(uint8_t *token, const GGMCover &cover,
+                                        int level) {
+  // pre-search, index the cover by leaf interval
+  vector<CoverInterval> intervals = build_intervals(cover, level);
+  // get the result, every label is HMAC(token, counter) so key it once
+  CryptoSuite::prf_key label_key;
+  CryptoSuite::prf_key_init(&label_key, token, DIGEST_SIZE);
+  // labels are expanded LABEL_BATCH counters at a time
+  int counters[LABEL_BATCH];
+  const uint8_t *label_inputs[LABEL_BATCH];
+  int label_input_lens[LABEL_BATCH];
+  uint8_t labels[LABEL_BATCH][DIGEST_SIZE];
+  for (int i = 0; i < LABEL_BATCH; ++i) {
+    label_inputs[i] = (uint8_t *)&counters[i];
+    label_input_lens[i] = sizeof(int);
+  }
   int counter = 0;
-  vector<string> res_list;
+  int next_label = LABEL_BATCH;
+  // one decryption per matched label, run as a single batch afterwards
+  vector<CryptoSuite::batch_item> items;
+  // the cover interval and leaf each queued decryption needs the key of
+  vector<const CoverInterval *> item_intervals;
+  vector<long> item_leaves;
   while (true) {
     // get label string
-    uint8_t label[DIGEST_SIZE];
-    hmac_digest((uint8_t *)&counter, sizeof(int), token, DIGEST_SIZE, label);
-    string label_str((char *)label, DIGEST_SIZE);
+    if (next_label == LABEL_BATCH) {
+      for (int i = 0; i < LABEL_BATCH; ++i) {
+        counters[i] = counter + i;
+      }
+      CryptoSuite::prf_key_digest_batch(&label_key, label_inputs,
+                                        label_input_lens, LABEL_BATCH,
+                                        labels[0]);
+      next_label = 0;
+    }
+    const LabelTable::Entry *entry = entries.find(labels[next_label++]);
     counter++;
     // terminate if no label
-    if (tags.find(label_str) == tags.end())
+    if (entry == nullptr)
       break;
     // get the insert position of the tag
     auto search_pos = BloomFilter<32, HASH_SIZE>::get_index(
-        (uint8_t *)tags[label_str].c_str(), this->GGM_SIZE);
+        entry->tag, this->GGM_SIZE, bf_index);
     sort(search_pos.begin(), search_pos.end());
-    // derive the key from search position and decrypt the id
-    vector<string> ciphertext_list = dict[label_str];
-    for (size_t i = 0; i < min(search_pos.size(), ciphertext_list.size());
-         ++i) {
-      vector<uint8_t> res(ciphertext_list[i].size() - SM4_BLOCK_SIZE);
-      if (root_key_map.find(search_pos[i]) == root_key_map.end())
-        break;
-      // derive key for the search position
-      uint8_t derive_key[SM4_BLOCK_SIZE];
-      std::memcpy(derive_key, node_list[root_key_map[search_pos[i]]].key,
-                  SM4_BLOCK_SIZE);
-      GGMTree::derive_key_from_tree(
-          derive_key, search_pos[i],
-          level - node_list[root_key_map[search_pos[i]]].level, 0);
-      int size =
-          sm4_decrypt((uint8_t *)(ciphertext_list[i].c_str() + SM4_BLOCK_SIZE),
-                      ciphertext_list[i].size() - SM4_BLOCK_SIZE, derive_key,
-                      (uint8_t *)ciphertext_list[i].c_str(), res.data());
-      if (size > 0) {
-        res_list.emplace_back(reinterpret_cast<const char *>(res.data()),
-                              ciphertext_list[i].size() - SM4_BLOCK_SIZE);
-      }
+    // derive the key from search position and queue the id for decryption,
+    // the ciphertexts of the entry are adjacent in its record
+    size_t count = min(search_pos.size(), static_cast<size_t>(entry->count));
+    const uint8_t *record =
+        count > 0 ? slabs[entry->slab].record(entry->record) : nullptr;
+    for (size_t i = 0; i < count; ++i) {
+      // a deleted position, the entry may still be live at the next one
+      const CoverInterval *interval = find_interval(intervals, search_pos[i]);
+      if (interval == nullptr)
+        continue;
+      // queue the key derivation for the search position
+      item_intervals.emplace_back(interval);
+      item_leaves.emplace_back(search_pos[i]);
+      const uint8_t *ciphertext = record + i * entry->length;
+      CryptoSuite::batch_item item{};
+      item.input = (uint8_t *)(ciphertext + SM4_BLOCK_SIZE);
+      item.input_len = entry->length - SM4_BLOCK_SIZE;
+      item.iv = (uint8_t *)ciphertext;
+      items.emplace_back(item);
       break;
     }
   }
+  CryptoSuite::prf_key_free(&label_key);
+  // distinct leaves in cover order with the cover node above each, results
+  // under the same node share the path from it
+  vector<size_t> order(items.size());
+  std::iota(order.begin(), order.end(), 0);
+  sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return std::tie(item_intervals[a]->start, item_leaves[a]) <
+           std::tie(item_intervals[b]->start, item_leaves[b]);
+  });
+  vector<long> leaves;
+  vector<size_t> leaf_nodes;
+  vector<uint8_t> leaf_keys(items.size() * SM4_BLOCK_SIZE);
+  for (size_t i : order) {
+    if (leaves.empty() || leaves.back() != item_leaves[i]) {
+      leaves.emplace_back(item_leaves[i]);
+      leaf_nodes.emplace_back(item_intervals[i]->node);
+    }
+    items[i].key = leaf_keys.data() + (leaves.size() - 1) * SM4_BLOCK_SIZE;
+  }
+  // derive the leaf keys in chunks, each chunk walks the paths below every
+  // cover node it touches together, so a node key is derived once per chunk.
+  // Only the bits below the cover node select the path, so the absolute leaf
+  // positions can be used as they are.
+  parallel_for(leaves.size(), DERIVE_CHUNK, [&](size_t begin, size_t end) {
+    for (size_t first = begin, last; first < end; first = last) {
+      for (last = first + 1;
+           last < end && leaf_nodes[last] == leaf_nodes[first]; ++last) {
+      }
+      size_t node = leaf_nodes[first];
+      GGMTree::derive_leaf_keys(cover.key(node), leaves.data() + first,
+                                last - first, level - cover.levels[node],
+                                leaf_keys.data() + first * SM4_BLOCK_SIZE, prg);
+    }
+  });
+  // decrypt all ids in batches
+  size_t plaintext_len = 0;
+  for (const auto &item : items) {
+    plaintext_len += item.input_len;
+  }
+  vector<uint8_t> plaintext(plaintext_len);
+  size_t offset = 0;
+  for (size_t i = 0; i < items.size(); ++i) {
+    items[i].output = plaintext.data() + offset;
+    offset += items[i].input_len;
+  }
+  parallel_for(items.size(), DECRYPT_CHUNK, [&](size_t begin, size_t end) {
+    CryptoSuite::decrypt_batch(items.data() + begin, end - begin);
+  });
+  vector<string> res_list;
+  res_list.reserve(items.size());
+  for (const auto &item : items) {
+    if (item.output_len > 0) {
+      res_list.emplace_back(reinterpret_cast<const char *>(item.output),
+                            item.output_len);
+    }
+  }
   return res_list;
 }
 
-void SSEServerHandler::compute_leaf_key_maps(const vector<GGMNode> &node_list,
-                                             int level) {
-  for (size_t i = 0; i < node_list.size(); i++) {
-    for (long j = 0; j < pow(2, level - node_list[i].level); ++j) {
-      long offset = ((node_list[i].index) << (level - node_list[i].level)) + j;
-      root_key_map[offset] = i;
-    }
+void SSEServerHandler::parallel_for(
+    size_t count, size_t min_chunk,
+    const std::function<void(size_t, size_t)> &f) const {
+  if (pool) {
+    pool->parallel_for(count, min_chunk, f);
+  } else if (count > 0) {
+    f(0, count);
+  }
+}
+
+vector<SSEServerHandler::CoverInterval>
+SSEServerHandler::build_intervals(const GGMCover &cover, int level) {
+  vector<CoverInterval> intervals;
+  intervals.reserve(cover.size());
+  for (size_t i = 0; i < cover.size(); i++) {
+    int height = level - cover.levels[i];
+    long start = cover.indices[i] << height;
+    intervals.push_back({start, start + (1L << height), i});
   }
-}
\ No newline at end of file
+  sort(intervals.begin(), intervals.end(),
+       [](const CoverInterval &a, const CoverInterval &b) {
+         return a.start < b.start;
+       });
+  return intervals;
+}
+
+const SSEServerHandler::CoverInterval *
+SSEServerHandler::find_interval(const vector<CoverInterval> &intervals,
+                                long leaf) {
+  // the last interval starting at or before leaf is the only candidate
+  auto it = std::upper_bound(
+      intervals.begin(), intervals.end(), leaf,
+      [](long pos, const CoverInterval &interval) {
+        return pos < interval.start;
+      });
+  if (it == intervals.begin() || leaf >= std::prev(it)->end)
+    return nullptr;
+  return &*std::prev(it);
+}
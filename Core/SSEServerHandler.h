@@ -1,26 +1,83 @@
 #ifndef AURA_SSESERVERHANDLER_H
 #define AURA_SSESERVERHANDLER_H
 
-#include "GGMNode.h"
+#include "BloomFilter.h"
+#include "GGMCover.h"
+#include "GGMTree.h"
+#include "LabelTable.h"
+#include "RecordSlab.h"
+#include "ThreadPool.h"
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <tuple>
 #include <vector>
 
 class SSEServerHandler {
 private:
-  std::unordered_map<std::string, std::string> tags;
-  std::unordered_map<std::string, std::vector<std::string>> dict;
-  std::unordered_map<long, uint8_t *> keys;
-  std::unordered_map<long, long> root_key_map;
-  int GGM_SIZE;
+  // label -> tag and the record of its ciphertexts
+  LabelTable entries;
+  // the ciphertexts of every entry as one record, a slab per record size
+  std::vector<RecordSlab> slabs;
+  bool huge_pages;
+  long GGM_SIZE;
+  GGMPrg prg;
+  BFIndex bf_index;
+  // splits the key derivation and decryption of a search, may be shared by
+  // several handlers or null to stay on the calling thread
+  std::shared_ptr<ThreadPool> pool;
 
-  void compute_leaf_key_maps(const std::vector<GGMNode> &node_list, int level);
+  // leaves [start, end) below cover node node
+  struct CoverInterval {
+    long start;
+    long end;
+    size_t node;
+  };
+
+  // labels of one keyword hashed together during a search
+  static constexpr int LABEL_BATCH = 16;
+  // smallest share of a search handed to one thread
+  static constexpr size_t DERIVE_CHUNK = 256;
+  static constexpr size_t DECRYPT_CHUNK = 1024;
+
+  // f(begin, end) over chunks of [0, count), on the pool when there is one
+  void parallel_for(size_t count, size_t min_chunk,
+                    const std::function<void(size_t, size_t)> &f) const;
+  // the slab of records of record_size bytes, slabs.size() when none
+  size_t find_slab(size_t record_size) const;
+  // the leaf intervals of the cover nodes sorted by start
+  static std::vector<CoverInterval> build_intervals(const GGMCover &cover,
+                                                    int level);
+  // the interval holding leaf, nullptr when the leaf is not covered
+  static const CoverInterval *
+  find_interval(const std::vector<CoverInterval> &intervals, long leaf);
 
 public:
-  explicit SSEServerHandler(int GGM_SIZE);
-  void add_entries(const std::string &label, const std::string &tag,
+  // capacity is the number of entries expected, 0 when unknown, and
+  // use_huge_pages backs the ciphertext slabs with transparent huge pages
+  explicit SSEServerHandler(long GGM_SIZE, GGMPrg ggm_prg = GGMPrg::KDF,
+                            BFIndex index = BFIndex::SEEDED,
+                            std::shared_ptr<ThreadPool> thread_pool = nullptr,
+                            long capacity = 0, bool use_huge_pages = false);
+  // whether add_entries accepts the entry: label and tag of DIGEST_SIZE
+  // bytes, at most 255 ciphertexts of one length between an iv and 65535
+  static bool valid_entry(const std::string &label, const std::string &tag,
+                          const std::vector<std::string> &ciphertext_list);
+  // false, adding nothing, when the entry is not valid_entry or the
+  // database already holds 256 different record sizes
+  bool add_entries(const std::string &label, const std::string &tag,
                    std::vector<std::string> ciphertext_list);
+  // label, tag and ciphertext list of an entry
+  using Entry =
+      std::tuple<std::string, std::string, std::vector<std::string>>;
+  // adds every entry of batch or, returning false, none of them: when one
+  // is not valid_entry, the record sizes would run out or a record slab is
+  // full. Allocates all the room the batch needs before adding the first.
+  bool add_entries_batch(std::vector<Entry> &batch);
+  std::vector<std::string> search(uint8_t *token, const GGMCover &cover,
+                                  int level);
+  // nothing when node_list is not a cover GGMCover::from_nodes accepts
   std::vector<std::string>
   search(uint8_t *token, const std::vector<GGMNode> &node_list, int level);
 };
@@ -0,0 +1,196 @@
+#ifndef AURA_GGMCOVER_H
+#define AURA_GGMCOVER_H
+
+#include "GGMNode.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The cover nodes of a search in the packed wire format, sent as one msgpack
+// bin instead of an array of GGMNode:
+//   varint count
+//   varint runs, then per run: u8 level, varint run length
+//   count varints, the first leaf below each node minus the previous one
+//   count * SM4_BLOCK_SIZE key bytes
+// Nodes go out in leaf order, so the leaf deltas are positive and small. The
+// keys of an unpacked cover point into the received buffer.
+class GGMCover {
+public:
+  std::vector<long> indices;
+  std::vector<int> levels;
+  const uint8_t *keys = nullptr; // SM4_BLOCK_SIZE bytes per node
+
+  size_t size() const { return indices.size(); }
+  const uint8_t *key(size_t i) const { return keys + i * SM4_BLOCK_SIZE; }
+
+  // the nodes of a tree with tree_level levels below the root, in packed form
+  static std::string pack(const std::vector<GGMNode> &nodes, int tree_level) {
+    std::vector<const GGMNode *> sorted(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      sorted[i] = &nodes[i];
+    }
+    auto first_leaf = [tree_level](const GGMNode *node) {
+      return node->index << (tree_level - node->level);
+    };
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&](const GGMNode *a, const GGMNode *b) {
+                       return first_leaf(a) < first_leaf(b);
+                     });
+
+    std::string out;
+    out.reserve(16 + nodes.size() * (4 + SM4_BLOCK_SIZE));
+    put_varint(out, sorted.size());
+    // levels, run-length encoded
+    std::vector<std::pair<int, uint64_t>> runs;
+    for (const GGMNode *node : sorted) {
+      if (runs.empty() || runs.back().first != node->level) {
+        runs.emplace_back(node->level, 0);
+      }
+      ++runs.back().second;
+    }
+    put_varint(out, runs.size());
+    for (auto [level, length] : runs) {
+      out.push_back(static_cast<char>(level));
+      put_varint(out, length);
+    }
+    // leaf deltas, then the keys back to back
+    long previous = 0;
+    for (const GGMNode *node : sorted) {
+      put_varint(out, first_leaf(node) - previous);
+      previous = first_leaf(node);
+    }
+    for (const GGMNode *node : sorted) {
+      out.append(reinterpret_cast<const char *>(node->key), SM4_BLOCK_SIZE);
+    }
+    return out;
+  }
+
+  // parse a packed cover of a tree with tree_level levels, false when the
+  // buffer is malformed or the nodes overlap or leave the tree
+  static bool unpack(const char *data, size_t len, int tree_level,
+                     GGMCover &cover) {
+    const auto *pos = reinterpret_cast<const uint8_t *>(data);
+    const uint8_t *end = pos + len;
+    uint64_t count, runs;
+    if (tree_level < 0 || tree_level > 62 || !get_varint(pos, end, count) ||
+        count > len / SM4_BLOCK_SIZE || !get_varint(pos, end, runs) ||
+        runs > count) {
+      return false;
+    }
+    cover.indices.resize(count);
+    cover.levels.resize(count);
+    size_t filled = 0;
+    for (uint64_t r = 0; r < runs; ++r) {
+      uint64_t length;
+      if (pos == end)
+        return false;
+      int level = *pos++;
+      if (level > tree_level || !get_varint(pos, end, length) ||
+          length > count - filled) {
+        return false;
+      }
+      std::fill_n(cover.levels.begin() + filled, length, level);
+      filled += length;
+    }
+    if (filled != count)
+      return false;
+    // every node must start past the end of the previous one
+    uint64_t next_free = 0, leaf = 0;
+    for (size_t i = 0; i < count; ++i) {
+      uint64_t delta;
+      if (!get_varint(pos, end, delta) || delta > (1ULL << tree_level))
+        return false;
+      leaf += delta;
+      int height = tree_level - cover.levels[i];
+      if (!place(leaf, height, tree_level, next_free))
+        return false;
+      cover.indices[i] = static_cast<long>(leaf >> height);
+    }
+    if (static_cast<size_t>(end - pos) != count * SM4_BLOCK_SIZE)
+      return false;
+    cover.keys = pos;
+    return true;
+  }
+
+  // a cover of a tree with tree_level levels over nodes, in leaf order, with
+  // their keys copied to key_storage, which must outlive it. False on the
+  // same nodes unpack rejects.
+  static bool from_nodes(const std::vector<GGMNode> &nodes, int tree_level,
+                         std::vector<uint8_t> &key_storage, GGMCover &cover) {
+    if (tree_level < 0 || tree_level > 62)
+      return false;
+    for (const GGMNode &node : nodes) {
+      if (node.level < 0 || node.level > tree_level || node.index < 0)
+        return false;
+    }
+    std::vector<const GGMNode *> sorted(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      sorted[i] = &nodes[i];
+    }
+    auto first_leaf = [tree_level](const GGMNode *node) {
+      return static_cast<uint64_t>(node->index) << (tree_level - node->level);
+    };
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&](const GGMNode *a, const GGMNode *b) {
+                       return first_leaf(a) < first_leaf(b);
+                     });
+    cover.indices.resize(nodes.size());
+    cover.levels.resize(nodes.size());
+    key_storage.resize(nodes.size() * SM4_BLOCK_SIZE);
+    uint64_t next_free = 0;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+      const GGMNode &node = *sorted[i];
+      int height = tree_level - node.level;
+      // an index past the tree would lose bits in first_leaf
+      if (static_cast<uint64_t>(node.index) >= (1ULL << node.level) ||
+          !place(first_leaf(&node), height, tree_level, next_free)) {
+        return false;
+      }
+      cover.indices[i] = node.index;
+      cover.levels[i] = node.level;
+      std::memcpy(key_storage.data() + i * SM4_BLOCK_SIZE, node.key,
+                  SM4_BLOCK_SIZE);
+    }
+    cover.keys = key_storage.data();
+    return true;
+  }
+
+private:
+  // whether a node of height height whose first leaf is leaf lies in the
+  // tree, aligned and past next_free, the end of the previous node. Moves
+  // next_free to its end.
+  static bool place(uint64_t leaf, int height, int tree_level,
+                    uint64_t &next_free) {
+    if (leaf < next_free || leaf % (1ULL << height) != 0 ||
+        leaf + (1ULL << height) > (1ULL << tree_level)) {
+      return false;
+    }
+    next_free = leaf + (1ULL << height);
+    return true;
+  }
+
+  static void put_varint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+      out.push_back(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+  }
+
+  static bool get_varint(const uint8_t *&pos, const uint8_t *end,
+                         uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos != end; shift += 7) {
+      uint8_t byte = *pos++;
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+};
+
+#endif // AURA_GGMCOVER_H
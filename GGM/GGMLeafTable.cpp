@@ -0,0 +1,140 @@
+#include "GGMLeafTable.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using std::string, std::vector;
+
+// file layout: this header, padded to HEADER_SIZE, then the leaf keys in
+// order. The magic is written last, so an interrupted expansion is redone.
+struct TableHeader {
+  char magic[8];
+  int64_t num_leaves;
+  int32_t level;
+  uint8_t prg;
+};
+
+static constexpr char TABLE_MAGIC[8] = {'G', 'G', 'M', 'L',
+                                        'E', 'A', 'F', '1'};
+static constexpr size_t HEADER_SIZE = 64;
+static_assert(sizeof(TableHeader) <= HEADER_SIZE);
+
+size_t GGMLeafTable::table_size(long num_leaves) {
+  return HEADER_SIZE + static_cast<size_t>(num_leaves) * SM4_BLOCK_SIZE;
+}
+
+GGMLeafTable::GGMLeafTable(const string &path, const uint8_t *root_key,
+                           long leaf_count, int level, GGMPrg prg)
+    : map_size(table_size(leaf_count)), num_leaves(leaf_count) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("cannot open GGM leaf table " + path + ": " +
+                             strerror(errno));
+  }
+  struct stat st {};
+  bool sized = fstat(fd, &st) == 0 &&
+               static_cast<size_t>(st.st_size) == map_size;
+  if (!sized && ftruncate(fd, static_cast<off_t>(map_size)) != 0) {
+    close(fd);
+    throw std::runtime_error("cannot resize GGM leaf table " + path + ": " +
+                             strerror(errno));
+  }
+  void *addr =
+      mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error("cannot map GGM leaf table " + path + ": " +
+                             strerror(errno));
+  }
+  map = static_cast<uint8_t *>(addr);
+  if (!sized || !load(root_key, level, prg)) {
+    expand(root_key, level, prg);
+  }
+}
+
+GGMLeafTable::~GGMLeafTable() {
+  if (map) {
+    munmap(map, map_size);
+  }
+}
+
+const uint8_t *GGMLeafTable::leaf_key(long index) const {
+  return map + HEADER_SIZE + static_cast<size_t>(index) * SM4_BLOCK_SIZE;
+}
+
+bool GGMLeafTable::load(const uint8_t *root_key, int level, GGMPrg prg) {
+  TableHeader header;
+  memcpy(&header, map, sizeof(header));
+  if (memcmp(header.magic, TABLE_MAGIC, sizeof(TABLE_MAGIC)) != 0 ||
+      header.num_leaves != num_leaves || header.level != level ||
+      header.prg != static_cast<uint8_t>(prg)) {
+    return false;
+  }
+  // the header says nothing about the root key or the crypto suite, so
+  // compare the first and the last leaf with a fresh derivation
+  for (long index : {0L, num_leaves - 1}) {
+    uint8_t key[SM4_BLOCK_SIZE];
+    memcpy(key, root_key, SM4_BLOCK_SIZE);
+    GGMTree::derive_key_from_tree(key, index, level, 0, prg);
+    if (memcmp(key, leaf_key(index), SM4_BLOCK_SIZE) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void GGMLeafTable::expand(const uint8_t *root_key, int level, GGMPrg prg) {
+  memset(map, 0, HEADER_SIZE);
+  // cut the tree into a few subtrees per core, the cores take them in turn
+  unsigned threads = std::max(1U, std::thread::hardware_concurrency());
+  int split = std::min(level, static_cast<int>(std::bit_width(threads * 4)));
+  int height = level - split;
+  long subtree_leaves = 1L << height;
+  long subtrees = (num_leaves + subtree_leaves - 1) / subtree_leaves;
+  std::atomic<long> next_subtree{0};
+  auto worker = [&]() {
+    vector<uint8_t> partial;
+    for (long t = next_subtree++; t < subtrees; t = next_subtree++) {
+      uint8_t node_key[SM4_BLOCK_SIZE];
+      memcpy(node_key, root_key, SM4_BLOCK_SIZE);
+      GGMTree::derive_key_from_tree(node_key, t, split, 0, prg);
+      long first = t * subtree_leaves;
+      uint8_t *leaf_keys = map + HEADER_SIZE + first * SM4_BLOCK_SIZE;
+      if (first + subtree_leaves <= num_leaves) {
+        GGMTree::derive_subtree_keys(node_key, height, leaf_keys, prg);
+        continue;
+      }
+      // the last subtree runs past the table, expand it aside
+      partial.resize(subtree_leaves * SM4_BLOCK_SIZE);
+      GGMTree::derive_subtree_keys(node_key, height, partial.data(), prg);
+      memcpy(leaf_keys, partial.data(), (num_leaves - first) * SM4_BLOCK_SIZE);
+    }
+  };
+  vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; ++i) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : pool) {
+    thread.join();
+  }
+
+  // persist the keys before the header marks the table complete
+  msync(map, map_size, MS_SYNC);
+  TableHeader header{};
+  memcpy(header.magic, TABLE_MAGIC, sizeof(TABLE_MAGIC));
+  header.num_leaves = num_leaves;
+  header.level = level;
+  header.prg = static_cast<uint8_t>(prg);
+  memcpy(map, &header, sizeof(header));
+  msync(map, HEADER_SIZE, MS_SYNC);
+}
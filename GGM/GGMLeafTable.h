@@ -0,0 +1,38 @@
+#ifndef AURA_GGMLEAFTABLE_H
+#define AURA_GGMLEAFTABLE_H
+
+#include "GGMTree.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Every leaf key of a GGM tree, expanded once and kept in a file mapped into
+// memory, so a leaf key costs a lookup instead of one PRG call per level.
+// The file holds secret keys and is created readable by its owner only.
+class GGMLeafTable {
+private:
+  uint8_t *map = nullptr;
+  size_t map_size = 0;
+  long num_leaves;
+
+  bool load(const uint8_t *root_key, int level, GGMPrg prg);
+  void expand(const uint8_t *root_key, int level, GGMPrg prg);
+
+public:
+  // Map the table at path when it was built for this root key, tree and PRG,
+  // otherwise expand the first leaf_count leaves over all cores and store them
+  // there. Throws std::runtime_error when the file cannot be mapped.
+  GGMLeafTable(const std::string &path, const uint8_t *root_key,
+               long leaf_count, int level, GGMPrg prg);
+  ~GGMLeafTable();
+  GGMLeafTable(const GGMLeafTable &) = delete;
+  GGMLeafTable &operator=(const GGMLeafTable &) = delete;
+
+  const uint8_t *leaf_key(long index) const;
+  long size() const { return num_leaves; }
+
+  // bytes of memory a table of num_leaves keys maps
+  static size_t table_size(long num_leaves);
+};
+
+#endif // AURA_GGMLEAFTABLE_H
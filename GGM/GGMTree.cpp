@@ -1,54 +1,214 @@
 #include "GGMTree.h"
-#include <cmath>
+#include "CryptoSuite.h"
+#include <algorithm>
+#include <bit>
 #include <cstddef>
 #include <vector>
 
 using std::vector;
 
-GGMTree::GGMTree(long num_node) { this->level = ceil(log2(num_node)); }
+GGMTree::GGMTree(long num_node, GGMPrg prg_version) : prg(prg_version) {
+  // levels below the root to hold num_node leaves, exact for any 64-bit size
+  this->level = std::bit_width(static_cast<uint64_t>(num_node - 1));
+}
 
 void GGMTree::derive_key_from_tree(uint8_t *current_key, long offset,
-                                   int start_level, int target_level) {
+                                   int start_level, int target_level,
+                                   GGMPrg prg) {
   uint8_t next_key[SM4_BLOCK_SIZE];
   // does not need to derive
   if (start_level == target_level)
     return;
   // derive tag
   for (int k = start_level; k > target_level; --k) {
-    int k_bit = (offset & (1 << (k - 1))) >> (k - 1);
-    key_derivation((uint8_t *)&k_bit, sizeof(int), current_key, SM4_BLOCK_SIZE,
-                   next_key);
+    int k_bit = (offset >> (k - 1)) & 1;
+    if (prg == GGMPrg::CIPHER) {
+      CryptoSuite::prg_derive(current_key, k_bit, next_key);
+    } else {
+      CryptoSuite::kdf((uint8_t *)&k_bit, sizeof(int), current_key,
+                       SM4_BLOCK_SIZE, next_key);
+    }
     memcpy(current_key, next_key, SM4_BLOCK_SIZE);
   }
 }
 
-vector<GGMNode> GGMTree::min_coverage(vector<GGMNode> node_list) {
-  vector<GGMNode> next_level_node(node_list.size());
+// replace every keys[i] by its child on side bits[i]
+static void derive_level(uint8_t *const *keys, const int *bits, size_t count,
+                         GGMPrg prg) {
+  if (prg == GGMPrg::CIPHER) {
+    CryptoSuite::prg_derive_batch(keys, bits, count);
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    uint8_t next_key[SM4_BLOCK_SIZE];
+    CryptoSuite::kdf((const uint8_t *)&bits[i], sizeof(int), keys[i],
+                     SM4_BLOCK_SIZE, next_key);
+    memcpy(keys[i], next_key, SM4_BLOCK_SIZE);
+  }
+}
 
-  for (size_t i = 0; i < node_list.size(); ++i) {
-    auto &node1 = node_list[i];
+void GGMTree::derive_keys_batch(uint8_t *const *keys, const long *offsets,
+                                const int *start_levels, size_t count,
+                                GGMPrg prg) {
+  int max_level = 0;
+  for (size_t i = 0; i < count; ++i) {
+    max_level = std::max(max_level, start_levels[i]);
+  }
+  vector<uint8_t *> level_keys;
+  vector<int> level_bits;
+  level_keys.reserve(count);
+  level_bits.reserve(count);
+  for (int k = max_level; k > 0; --k) {
+    // the chains that still have level k ahead of them
+    level_keys.clear();
+    level_bits.clear();
+    for (size_t i = 0; i < count; ++i) {
+      if (start_levels[i] >= k) {
+        level_keys.emplace_back(keys[i]);
+        level_bits.emplace_back((offsets[i] >> (k - 1)) & 1);
+      }
+    }
+    derive_level(level_keys.data(), level_bits.data(), level_keys.size(), prg);
+  }
+}
 
-    if (i + 1 == node_list.size()) {
-      next_level_node[i] = node1;
-    } else {
-      auto &node2 = node_list[i + 1];
-      // same parent in the binary path
-      if (((node1.index >> 1) == (node2.index >> 1)) &&
-          (node1.level == node2.level)) {
-        next_level_node[i] = GGMNode(node1.index >> 1, node1.level - 1);
-        i++;
-      } else {
-        next_level_node[i] = node1;
+void GGMTree::derive_leaf_keys(const uint8_t *root_key, const long *leaves,
+                               size_t count, int tree_level,
+                               uint8_t *leaf_keys, GGMPrg prg) {
+  if (count == 0)
+    return;
+  // the nodes of one level that have leaves below them, leaves[lo, hi)
+  struct Frontier {
+    size_t lo, hi;
+  };
+  vector<Frontier> frontier{{0, count}}, next_frontier;
+  vector<uint8_t> keys(root_key, root_key + SM4_BLOCK_SIZE), next_keys;
+  vector<uint8_t *> key_ptrs;
+  vector<int> bits;
+  frontier.reserve(count);
+  next_frontier.reserve(count);
+  keys.reserve(count * SM4_BLOCK_SIZE);
+  next_keys.reserve(count * SM4_BLOCK_SIZE);
+  key_ptrs.reserve(count);
+  bits.reserve(count);
+  for (int k = tree_level; k > 0; --k) {
+    // split every node's leaves on the bit of level k, the children start
+    // as copies of their parent and are derived in place
+    next_frontier.clear();
+    next_keys.clear();
+    bits.clear();
+    for (size_t n = 0; n < frontier.size(); ++n) {
+      auto [lo, hi] = frontier[n];
+      const uint8_t *parent = keys.data() + n * SM4_BLOCK_SIZE;
+      auto is_left = [k](long leaf) { return ((leaf >> (k - 1)) & 1) == 0; };
+      size_t mid =
+          std::partition_point(leaves + lo, leaves + hi, is_left) - leaves;
+      if (lo < mid) {
+        next_frontier.push_back({lo, mid});
+        next_keys.insert(next_keys.end(), parent, parent + SM4_BLOCK_SIZE);
+        bits.emplace_back(0);
+      }
+      if (mid < hi) {
+        next_frontier.push_back({mid, hi});
+        next_keys.insert(next_keys.end(), parent, parent + SM4_BLOCK_SIZE);
+        bits.emplace_back(1);
       }
     }
+    key_ptrs.clear();
+    for (size_t n = 0; n < next_frontier.size(); ++n) {
+      key_ptrs.emplace_back(next_keys.data() + n * SM4_BLOCK_SIZE);
+    }
+    derive_level(key_ptrs.data(), bits.data(), key_ptrs.size(), prg);
+    frontier.swap(next_frontier);
+    keys.swap(next_keys);
   }
+  memcpy(leaf_keys, keys.data(), count * SM4_BLOCK_SIZE);
+}
 
-  // no merge return
-  if (next_level_node.size() == node_list.size() || next_level_node.empty()) {
-    return node_list;
+void GGMTree::derive_subtree_keys(const uint8_t *node_key, int height,
+                                  uint8_t *leaf_keys, GGMPrg prg) {
+  constexpr size_t CHUNK = 256;
+  uint8_t *key_ptrs[CHUNK];
+  int bits[CHUNK];
+  memcpy(leaf_keys, node_key, SM4_BLOCK_SIZE);
+  for (int h = 0; h < height; ++h) {
+    // node i of this level moves to slots 2i and 2i + 1, the last node first
+    // so that no parent is overwritten before it is copied
+    size_t nodes = 1UL << h;
+    for (size_t i = nodes; i-- > 0;) {
+      uint8_t *parent = leaf_keys + i * SM4_BLOCK_SIZE;
+      memcpy(leaf_keys + (2 * i + 1) * SM4_BLOCK_SIZE, parent, SM4_BLOCK_SIZE);
+      memmove(leaf_keys + 2 * i * SM4_BLOCK_SIZE, parent, SM4_BLOCK_SIZE);
+    }
+    for (size_t first = 0; first < 2 * nodes; first += CHUNK) {
+      size_t n = std::min(CHUNK, 2 * nodes - first);
+      for (size_t j = 0; j < n; ++j) {
+        key_ptrs[j] = leaf_keys + (first + j) * SM4_BLOCK_SIZE;
+        bits[j] = (first + j) & 1;
+      }
+      derive_level(key_ptrs, bits, n, prg);
+    }
+  }
+}
+
+// first position >= pos whose bit equals value, num_bits if there is none
+static long find_bit(const uint64_t *words, long pos, long num_bits,
+                     bool value) {
+  long num_words = (num_bits + 63) / 64;
+  long w = pos / 64;
+  uint64_t word = (value ? words[w] : ~words[w]) & (~0ULL << (pos % 64));
+  while (word == 0) {
+    if (++w == num_words)
+      return num_bits;
+    word = value ? words[w] : ~words[w];
+  }
+  return std::min(num_bits, w * 64 + std::countr_zero(word));
+}
+
+void GGMTree::min_coverage(const uint64_t *leaf_bits, long num_leaves,
+                           vector<GGMNode> &cover, bool live) const {
+  long start = 0;
+  while (start < num_leaves) {
+    // next run [start, end) of live leaves
+    start = find_bit(leaf_bits, start, num_leaves, live);
+    if (start == num_leaves)
+      break;
+    long end = find_bit(leaf_bits, start, num_leaves, !live);
+    cover_range(start, end, cover);
+    start = end;
+  }
+}
+
+void GGMTree::cover_range(long start, long end,
+                          vector<GGMNode> &cover) const {
+  // split [start, end) into the largest aligned subtrees, left to right
+  while (start < end) {
+    int height = std::bit_width(static_cast<uint64_t>(end - start)) - 1;
+    if (start != 0) {
+      height = std::min(height,
+                        std::countr_zero(static_cast<uint64_t>(start)));
+    }
+    cover.emplace_back(start >> height, level - height);
+    start += 1L << height;
   }
+}
 
-  return min_coverage(next_level_node);
+void GGMTree::split_node(const GGMNode &node, long leaf,
+                         vector<GGMNode> &cover) const {
+  uint8_t path_key[SM4_BLOCK_SIZE];
+  memcpy(path_key, node.key, SM4_BLOCK_SIZE);
+  long index = node.index;
+  for (int depth = node.level + 1; depth <= level; ++depth) {
+    // the child towards leaf goes on, its sibling keeps live leaves only
+    long child = index * 2 + ((leaf >> (level - depth)) & 1);
+    GGMNode sibling(child ^ 1, depth, path_key);
+    derive_key_from_tree(sibling.key, sibling.index, 1, 0, prg);
+    cover.emplace_back(sibling);
+    derive_key_from_tree(path_key, child, 1, 0, prg);
+    index = child;
+  }
 }
 
-int GGMTree::get_level() const { return level; }
\ No newline at end of file
+int GGMTree::get_level() const { return level; }
+
+GGMPrg GGMTree::get_prg() const { return prg; }
\ No newline at end of file
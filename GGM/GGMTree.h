@@ -2,18 +2,61 @@
 #define AURA_GGMTREE_H
 
 #include "GGMNode.h"
+#include <cstdint>
 #include <vector>
 
+// PRG used to derive the children of a GGM node, on the primitives of the
+// configured CryptoSuite. The value is sent to the server in init_handler, so
+// existing databases keep their original PRG.
+enum class GGMPrg : uint8_t {
+  KDF = 0,    // kdf(parent, bit), MD5(HMAC-SM3) in the original suite
+  CIPHER = 1, // E_parent(bit), one block encryption per level
+};
+
 class GGMTree {
 private:
   int level;
+  GGMPrg prg;
 
 public:
-  explicit GGMTree(long num_node);
+  explicit GGMTree(long num_node, GGMPrg prg_version = GGMPrg::KDF);
   void static derive_key_from_tree(uint8_t *current_key, long offset,
-                                   int start_level, int target_level);
-  std::vector<GGMNode> min_coverage(std::vector<GGMNode> node_list);
+                                   int start_level, int target_level,
+                                   GGMPrg prg = GGMPrg::KDF);
+  // derive_key_from_tree on many keys at once: keys[i] goes from level
+  // start_levels[i] down to the leaf offsets[i]. All chains advance one level
+  // per step, so the CIPHER PRG runs one multi-key batch per level.
+  void static derive_keys_batch(uint8_t *const *keys, const long *offsets,
+                                const int *start_levels, size_t count,
+                                GGMPrg prg = GGMPrg::KDF);
+  // keys of count sorted, distinct leaves at tree_level below root_key,
+  // written SM4_BLOCK_SIZE bytes apart to leaf_keys. The paths are walked
+  // together from the root, so a node shared by several leaves is derived once.
+  void static derive_leaf_keys(const uint8_t *root_key, const long *leaves,
+                               size_t count, int tree_level, uint8_t *leaf_keys,
+                               GGMPrg prg = GGMPrg::KDF);
+  // keys of all 2^height leaves below node_key, in leaf order. The levels
+  // are expanded in place in leaf_keys, which holds 2^height keys.
+  void static derive_subtree_keys(const uint8_t *node_key, int height,
+                                  uint8_t *leaf_keys, GGMPrg prg = GGMPrg::KDF);
+  // append to cover the minimum set of subtrees whose leaves are exactly the
+  // live leaves among the first num_leaves. Leaf i is live when bit i % 64 of
+  // leaf_bits[i / 64] equals live, so the bitset of delete_bf can be passed
+  // with live = false. Runs of live leaves are found a word at a time and
+  // split into aligned subtrees, so the cost is the words scanned plus the
+  // output.
+  void min_coverage(const uint64_t *leaf_bits, long num_leaves,
+                    std::vector<GGMNode> &cover, bool live = true) const;
+  // append to cover the minimum set of subtrees whose leaves are exactly
+  // [start, end), at most two per level
+  void cover_range(long start, long end, std::vector<GGMNode> &cover) const;
+  // append to cover, with their keys, the siblings of the path from node down
+  // to the leaf below it, the minimum cover of node's leaves without leaf.
+  // Costs two PRG calls per level between node and the leaves.
+  void split_node(const GGMNode &node, long leaf,
+                  std::vector<GGMNode> &cover) const;
   int get_level() const;
+  GGMPrg get_prg() const;
 };
 
 #endif // AURA_GGMTREE_H
@@ -1,11 +1,14 @@
 #include "Core/SDSSECQSClient.h"
+#include <algorithm>
 #include <args.hxx>
 #include <cstddef>
+#include <exception>
 #include <format>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -37,10 +40,20 @@ parse_file(const std::string &filename) {
   return data;
 }
 
-static void index_file(const std::string &filename) {
+static void index_file(const std::string &filename, GGMPrg prg,
+                       BFIndex bf_index, const std::string &deletions_dir,
+                       const std::string &leaf_table_dir,
+                       size_t leaf_table_budget) {
   auto data = parse_file(filename);
   SDSSECQSClient client(static_cast<int>(data.size()),
-                        static_cast<int>(data.size()), true);
+                        static_cast<int>(data.size()), true, prg, bf_index);
+  client.keep_deletions(deletions_dir);
+  if (!leaf_table_dir.empty() &&
+      !client.use_leaf_tables(leaf_table_dir, leaf_table_budget)) {
+    std::cout << "GGM leaf table exceeds the memory budget, deriving leaf "
+                 "keys on demand"
+              << std::endl;
+  }
   size_t total_keywords = 0;
   for (size_t i = 0; i < data.size(); ++i) {
     const auto &[id, keywords] = data[i];
@@ -60,10 +73,13 @@ static void index_file(const std::string &filename) {
   client.flush();
 }
 
-static void delete_id(const std::string &filename, unsigned int target_id) {
+static void delete_id(const std::string &filename, unsigned int target_id,
+                      GGMPrg prg, BFIndex bf_index,
+                      const std::string &deletions_dir) {
   auto data = parse_file(filename);
   SDSSECQSClient client(static_cast<int>(data.size()),
-                        static_cast<int>(data.size()), false);
+                        static_cast<int>(data.size()), false, prg, bf_index);
+  client.keep_deletions(deletions_dir);
 
   auto it =
       std::find_if(data.begin(), data.end(), [target_id](const auto &pair) {
@@ -86,7 +102,10 @@ static void delete_id(const std::string &filename, unsigned int target_id) {
 }
 
 static void search_keywords(const std::string &filename,
-                            const std::vector<std::string> &search_keywords) {
+                            const std::vector<std::string> &search_keywords,
+                            GGMPrg prg, BFIndex bf_index,
+                            const std::string &deletions_dir,
+                            unsigned threads) {
   if (search_keywords.empty()) {
     std::cerr << "At least one keyword is required for search." << std::endl;
     return;
@@ -95,7 +114,8 @@ static void search_keywords(const std::string &filename,
   // Load data to reconstruct keyword counters (CT) so token generation works.
   auto data = parse_file(filename);
   SDSSECQSClient client(static_cast<int>(data.size()),
-                        static_cast<int>(data.size()), false);
+                        static_cast<int>(data.size()), false, prg, bf_index);
+  client.keep_deletions(deletions_dir);
 
   std::unordered_map<std::string, int> counts;
   std::unordered_map<unsigned int, std::vector<std::string>> id_to_keywords;
@@ -108,6 +128,7 @@ static void search_keywords(const std::string &filename,
   std::cout << std::format("{} keywords found in file.", counts.size())
             << std::endl;
   client.load_CT(counts);
+  client.set_threads(threads);
 
   // direct call with new signature
   std::vector<int> result = client.search(search_keywords);
@@ -144,6 +165,32 @@ int main(int argc, char **argv) {
   args::Command delete_(subcommands, "delete", "delete the file");
   args::Command search(subcommands, "search", "search the file");
   args::HelpFlag help(parser, "help", "Display this help menu", {'h', "help"});
+  args::Flag cipher_prg(parser, "cipher-prg",
+                        "Derive the GGM tree with the block cipher, the index "
+                        "and every later command must use the same setting",
+                        {"cipher-prg"});
+  args::Flag double_hash(parser, "double-hash",
+                         "Map tags to GGM leaves from one hash per tag, the "
+                         "index and every later command must use the same "
+                         "setting",
+                         {"double-hash"});
+  args::ValueFlag<std::string> deletions(
+      parser, "dir",
+      "Keep the deleted entries in filter files in this directory, created "
+      "by the index and updated by every delete (default: .)",
+      {"deletions"}, ".");
+  args::ValueFlag<std::string> leaf_table(
+      parser, "dir",
+      "Keep every GGM leaf key in a table file in this directory while "
+      "indexing, expanded once and reused by later runs",
+      {"leaf-table"});
+  args::ValueFlag<size_t> leaf_table_budget(
+      parser, "MiB", "Largest GGM leaf table to keep in memory (default 1024)",
+      {"leaf-table-budget"}, 1024);
+  args::ValueFlag<unsigned> threads(
+      parser, "threads",
+      "Threads deriving GGM keys during a search (default: all cores)",
+      {'t', "threads"}, std::max(1U, std::thread::hardware_concurrency()));
   args::ArgumentParser subparser("index");
   args::Positional<std::string> file(index, "file", "The file to index");
   args::Positional<std::string> file_del(delete_, "file",
@@ -169,27 +216,40 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  if (index) {
-    index_file(args::get(file));
-  } else if (delete_) {
-    if (!file_del || !id) {
-      std::cerr << "Both file and id are required for delete operation"
-                << std::endl;
-      std::cerr << parser;
-      return 1;
-    }
-    delete_id(args::get(file_del), args::get(id));
-  } else if (search) {
-    if (!file_search || !keywords) {
-      std::cerr << "Both file and keywords are required for search operation"
-                << std::endl;
+  GGMPrg prg = cipher_prg ? GGMPrg::CIPHER : GGMPrg::KDF;
+  BFIndex bf_index = double_hash ? BFIndex::DOUBLE_HASH : BFIndex::SEEDED;
+  // a filter file of another database, or a new database meeting an old
+  // one, ends the command with its message
+  try {
+    if (index) {
+      index_file(args::get(file), prg, bf_index, args::get(deletions),
+                 args::get(leaf_table), args::get(leaf_table_budget) << 20);
+    } else if (delete_) {
+      if (!file_del || !id) {
+        std::cerr << "Both file and id are required for delete operation"
+                  << std::endl;
+        std::cerr << parser;
+        return 1;
+      }
+      delete_id(args::get(file_del), args::get(id), prg, bf_index,
+                args::get(deletions));
+    } else if (search) {
+      if (!file_search || !keywords) {
+        std::cerr << "Both file and keywords are required for search operation"
+                  << std::endl;
+        std::cerr << parser;
+        return 1;
+      }
+      search_keywords(args::get(file_search), args::get(keywords), prg,
+                      bf_index, args::get(deletions),
+                      std::max(1U, args::get(threads)));
+    } else {
+      std::cerr << "No command specified" << std::endl;
       std::cerr << parser;
       return 1;
     }
-    search_keywords(args::get(file_search), args::get(keywords));
-  } else {
-    std::cerr << "No command specified" << std::endl;
-    std::cerr << parser;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
     return 1;
   }
 }
\ No newline at end of file
@@ -3,7 +3,10 @@
  */
 #pragma once
 
+#include "BF/BloomFilter.h"
+#include "GGM/GGMCover.h"
 #include "GGM/GGMNode.h"
+#include "GGM/GGMTree.h"
 #include "Util/CommonUtil.h"
 
 #include <arpa/inet.h>
@@ -65,10 +68,17 @@ public:
     return res["status"] == "ok";
   }
 
-  // Search API.
+  // Search API. The cover nodes go out in the packed GGMCover format.
   inline bool search(const std::string &token,
                      const std::vector<GGMNode> &node_list, int level,
                      std::vector<std::string> &res) const {
+    return search_packed(token, GGMCover::pack(node_list, level), level, res);
+  }
+
+  // Search with a cover already in the output of GGMCover::pack, so a client
+  // that keeps its cover between searches packs it once.
+  inline bool search_packed(const std::string &token, const std::string &cover,
+                            int level, std::vector<std::string> &res) const {
     if (token.size() != DIGEST_SIZE) {
       std::cerr << "Token size mismatch" << std::endl;
       return false;
@@ -86,8 +96,9 @@ public:
     packer.pack(db_id_);
     packer.pack(std::string("token"));
     packer.pack(token);
-    packer.pack(std::string("node_list"));
-    packer.pack(node_list);
+    packer.pack(std::string("cover"));
+    packer.pack_bin(cover.size());
+    packer.pack_bin_body(cover.data(), cover.size());
     packer.pack(std::string("level"));
     packer.pack(level);
 
@@ -105,8 +116,14 @@ public:
     return true;
   }
 
-  // Initialise / re-initialise the server-side handler with given GGM size.
-  inline bool init_handler(int ggm_size) const {
+  // Initialise / re-initialise the server-side handler with given GGM size,
+  // the PRG used to derive the GGM tree of this database, the name of the
+  // client's CryptoSuite, which the server checks against its own, and the
+  // mapping of tags to GGM leaves.
+  inline bool init_handler(long ggm_size, GGMPrg prg = GGMPrg::KDF,
+                           const std::string &crypto_suite = "SM",
+                           BFIndex bf_index = BFIndex::SEEDED,
+                           long capacity = 0) const {
     if (ggm_size <= 0) {
       std::cerr << "Invalid ggm_size" << std::endl;
       return false;
@@ -117,13 +134,21 @@ public:
 
     msgpack::sbuffer buf;
     msgpack::packer packer(buf);
-    packer.pack_map(3);
+    packer.pack_map(7);
     packer.pack(std::string("cmd"));
     packer.pack(std::string("init_handler"));
     packer.pack(std::string("db"));
     packer.pack(db_id_);
     packer.pack(std::string("ggm_size"));
-    packer.pack(ggm_size);
+    packer.pack(static_cast<int64_t>(ggm_size));
+    packer.pack(std::string("ggm_prg"));
+    packer.pack(static_cast<int>(prg));
+    packer.pack(std::string("crypto_suite"));
+    packer.pack(crypto_suite);
+    packer.pack(std::string("bf_index"));
+    packer.pack(static_cast<int>(bf_index));
+    packer.pack(std::string("capacity"));
+    packer.pack(static_cast<int64_t>(capacity));
 
     if (!send_msg(fd, buf)) {
       close_socket();
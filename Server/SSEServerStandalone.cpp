@@ -1,5 +1,7 @@
 #include "Core/SSEServerHandler.h"
+#include "GGM/GGMCover.h"
 #include "GGM/GGMNode.h"
+#include "GGM/GGMTree.h"
 #include <args.hxx>
 
 #include <arpa/inet.h>
@@ -8,15 +10,16 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstring>
-#include <execution>
 #include <format>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <msgpack.hpp>
 #include <mutex>
+#include <new>
 #include <shared_mutex>
 #include <string_view>
 #include <thread>
@@ -25,6 +28,8 @@
 #include <vector>
 
 #include "Util/CommonUtil.h"
+#include "Util/CryptoSuite.h"
+#include "Util/ThreadPool.h"
 
 static constexpr uint16_t DEFAULT_PORT = 5000;
 static constexpr const char *DEFAULT_HOST = "0.0.0.0";
@@ -120,6 +125,12 @@ struct HandlerContext {
 static std::unordered_map<std::string, HandlerContext>
     g_handlers;                       // db_id -> context
 static std::mutex g_handlers_map_mtx; // guards g_handlers modifications
+// worker threads shared by the searches of all handlers
+static std::shared_ptr<ThreadPool> g_search_pool;
+// back the ciphertext slabs of every handler with transparent huge pages
+static bool g_huge_pages = false;
+// most entries a handler reserves room for up front, whatever a client asks
+static int64_t g_max_capacity = 1 << 20;
 // -------------------------------------------------------------------
 
 // Convenience helpers to reduce repetition inside the request loop
@@ -215,7 +226,11 @@ static void handle_client(int client_fd) {
         req["label"].convert(label);
         req["tag"].convert(tag);
         req["ciphertext_list"].convert(ciphertext_list);
-        handler_ptr->add_entries(label, tag, std::move(ciphertext_list));
+        if (!handler_ptr->add_entries(label, tag,
+                                      std::move(ciphertext_list))) {
+          send_error(client_fd, "invalid label or tag");
+          break;
+        }
         auto dur = std::chrono::steady_clock::now() - start;
         log("add_entries took {}", format_duration(dur));
         // send simple ack
@@ -228,9 +243,7 @@ static void handle_client(int client_fd) {
         }
         // entries is vector of tuple<string,label>,string tag, vector<string>
         // ciphertext_list
-        std::vector<
-            std::tuple<std::string, std::string, std::vector<std::string>>>
-            entries;
+        std::vector<SSEServerHandler::Entry> entries;
         try {
           req["entries"].convert(entries);
         } catch (...) {
@@ -238,15 +251,19 @@ static void handle_client(int client_fd) {
           break;
         }
         auto start = std::chrono::steady_clock::now();
-        {
+        // the batch is added whole or not at all, an error stores nothing
+        bool added;
+        try {
           std::unique_lock<std::shared_mutex> lock(*handler_mtx);
-          std::for_each(std::execution::unseq, entries.begin(), entries.end(),
-                        [&](const auto &one) {
-                          const auto &label = std::get<0>(one);
-                          const auto &tag = std::get<1>(one);
-                          const auto &cipher_list = std::get<2>(one);
-                          handler_ptr->add_entries(label, tag, cipher_list);
-                        });
+          added = handler_ptr->add_entries_batch(entries);
+        } catch (const std::bad_alloc &) {
+          send_error(client_fd, "out of memory");
+          break;
+        }
+        if (!added) {
+          log("add_entries_batch rejected {} items", entries.size());
+          send_error(client_fd, "invalid entries");
+          break;
         }
         auto dur = std::chrono::steady_clock::now() - start;
         log("add_entries_batch ({} items) took {}", entries.size(),
@@ -261,17 +278,36 @@ static void handle_client(int client_fd) {
         std::shared_lock<std::shared_mutex> read_lock(*handler_mtx);
         auto start = std::chrono::steady_clock::now();
         std::string token_str;
-        std::vector<GGMNode> node_list;
         int level;
         req["token"].convert(token_str);
-        req["node_list"].convert(node_list);
         req["level"].convert(level);
         if (token_str.size() != DIGEST_SIZE) {
           std::cerr << "Invalid token size from client." << std::endl;
           break;
         }
+        // packed cover, its keys stay in the request buffer. Older clients
+        // send node_list instead.
+        GGMCover cover;
+        std::vector<uint8_t> cover_keys;
+        auto cover_it = req.find("cover");
+        if (cover_it != req.end()) {
+          const msgpack::object &blob = cover_it->second;
+          if (blob.type != msgpack::type::BIN ||
+              !GGMCover::unpack(blob.via.bin.ptr, blob.via.bin.size, level,
+                                cover)) {
+            send_error(client_fd, "invalid cover");
+            break;
+          }
+        } else {
+          std::vector<GGMNode> node_list;
+          req["node_list"].convert(node_list);
+          if (!GGMCover::from_nodes(node_list, level, cover_keys, cover)) {
+            send_error(client_fd, "invalid cover");
+            break;
+          }
+        }
         std::vector<std::string> res =
-            handler_ptr->search((uint8_t *)token_str.data(), node_list, level);
+            handler_ptr->search((uint8_t *)token_str.data(), cover, level);
         auto dur = std::chrono::steady_clock::now() - start;
         log("search took {}", format_duration(dur));
         {
@@ -282,7 +318,7 @@ static void handle_client(int client_fd) {
         break;
       }
       case CommandType::InitHandler: {
-        int new_size = 0;
+        int64_t new_size = 0;
         try {
           req["ggm_size"].convert(new_size);
         } catch (...) {
@@ -292,13 +328,73 @@ static void handle_client(int client_fd) {
           send_msg(client_fd, sbuf);
           break;
         }
-        if (new_size <= 0) {
+        // a packed cover addresses at most 2^62 leaves
+        if (new_size <= 0 || new_size > (int64_t{1} << 62)) {
           msgpack::sbuffer sbuf;
           msgpack::pack(sbuf, std::map<std::string, std::string>{
                                   {"error", "invalid ggm_size"}});
           send_msg(client_fd, sbuf);
           break;
         }
+        // clients that predate the field use the original PRG
+        int prg_version = static_cast<int>(GGMPrg::KDF);
+        auto prg_field_it = req.find("ggm_prg");
+        if (prg_field_it != req.end()) {
+          try {
+            prg_field_it->second.convert(prg_version);
+          } catch (...) {
+            prg_version = -1;
+          }
+        }
+        if (prg_version != static_cast<int>(GGMPrg::KDF) &&
+            prg_version != static_cast<int>(GGMPrg::CIPHER)) {
+          send_error(client_fd, "invalid ggm_prg");
+          break;
+        }
+        // likewise for the tag to leaf mapping
+        int bf_index = static_cast<int>(BFIndex::SEEDED);
+        auto index_field_it = req.find("bf_index");
+        if (index_field_it != req.end()) {
+          try {
+            index_field_it->second.convert(bf_index);
+          } catch (...) {
+            bf_index = -1;
+          }
+        }
+        if (bf_index != static_cast<int>(BFIndex::SEEDED) &&
+            bf_index != static_cast<int>(BFIndex::DOUBLE_HASH)) {
+          send_error(client_fd, "invalid bf_index");
+          break;
+        }
+        // the entries the client expects, 0 when it does not say. Only a
+        // hint: at most g_max_capacity are reserved, the table grows past it.
+        int64_t capacity = 0;
+        auto capacity_field_it = req.find("capacity");
+        if (capacity_field_it != req.end()) {
+          try {
+            capacity_field_it->second.convert(capacity);
+          } catch (...) {
+            capacity = -1;
+          }
+        }
+        if (capacity < 0) {
+          send_error(client_fd, "invalid capacity");
+          break;
+        }
+        capacity = std::min(capacity, g_max_capacity);
+        // a client built with another suite could not decrypt our results
+        auto suite_field_it = req.find("crypto_suite");
+        if (suite_field_it != req.end()) {
+          std::string client_suite;
+          try {
+            suite_field_it->second.convert(client_suite);
+          } catch (...) {
+          }
+          if (client_suite != CryptoSuite::name) {
+            send_error(client_fd, "crypto suite mismatch");
+            break;
+          }
+        }
 
         {
           // Obtain (or create) the context for this db
@@ -311,10 +407,19 @@ static void handle_client(int client_fd) {
             }
           }
           std::unique_lock<std::shared_mutex> lock(*ctx_ptr->mtx);
-          ctx_ptr->handler = std::make_shared<SSEServerHandler>(new_size);
+          try {
+            ctx_ptr->handler = std::make_shared<SSEServerHandler>(
+                new_size, static_cast<GGMPrg>(prg_version),
+                static_cast<BFIndex>(bf_index), g_search_pool, capacity,
+                g_huge_pages);
+          } catch (const std::bad_alloc &) {
+            send_error(client_fd, "out of memory");
+            break;
+          }
         }
-        log("[db:{}] Handler (re)initialised with GGM_SIZE {}", db_id,
-            new_size);
+        log("[db:{}] Handler (re)initialised with GGM_SIZE {}, GGM PRG {}, "
+            "BF index {}, capacity {}",
+            db_id, new_size, prg_version, bf_index, capacity);
         send_status_ok(client_fd);
         break;
       }
@@ -343,6 +448,19 @@ int main(int argc, char *argv[]) {
   args::ValueFlag<uint16_t> port(parser, "port",
                                  "Port to listen on (default: 5000)",
                                  {'p', "port"}, DEFAULT_PORT);
+  args::ValueFlag<unsigned> threads(
+      parser, "threads",
+      "Threads deriving keys and decrypting results during a search "
+      "(default: all cores)",
+      {'t', "threads"}, std::max(1U, std::thread::hardware_concurrency()));
+  args::Flag huge_pages(parser, "huge-pages",
+                        "Keep ciphertexts in transparent huge pages",
+                        {"huge-pages"});
+  args::ValueFlag<int64_t> max_capacity(
+      parser, "max-capacity",
+      "Most entries a database reserves room for when it is initialised, "
+      "larger hints are cut to it (default: 1048576)",
+      {"max-capacity"}, g_max_capacity);
 
   try {
     parser.ParseCLI(argc, argv);
@@ -355,6 +473,11 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  g_search_pool =
+      std::make_shared<ThreadPool>(std::max(1U, args::get(threads)));
+  g_huge_pages = huge_pages;
+  g_max_capacity = std::max<int64_t>(0, args::get(max_capacity));
+
   int server_fd = ::socket(AF_INET, SOCK_STREAM, 0);
   if (server_fd < 0) {
     perror("socket");
@@ -400,7 +523,9 @@ int main(int argc, char *argv[]) {
     close(server_fd);
     return 1;
   }
-  log("SSE Server listening on {}:{}", args::get(host), args::get(port));
+  log("SSE Server listening on {}:{} ({} crypto suite, {} search threads)",
+      args::get(host), args::get(port), CryptoSuite::name,
+      g_search_pool->size());
 
   while (true) {
     sockaddr_in client_addr{};
@@ -0,0 +1,113 @@
+#include "../BF/BloomFilter.h"
+#include "../BF/DigestSet.h"
+extern "C" {
+#include "../Util/CommonUtil.h"
+}
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Times BloomFilter, in both index modes, at the xset parameters of
+// SDSSECQSClient::search and at those of delete_bf: insert MAX_DB_SIZE tags,
+// look all of them up, then ten times as many absent ones. The absent
+// lookups give the measured false positive rate. The exact DigestSet that
+// the conjunctive searches use per xterm runs the same workload.
+
+using std::chrono::duration, std::chrono::steady_clock;
+
+static constexpr size_t TAG_SIZE = 128;
+static constexpr long ABSENT = 10L * MAX_DB_SIZE;
+
+// n distinct tags, the first 8 bytes numbered from first
+static std::vector<uint8_t> make_tags(long first, long n) {
+  std::vector<uint8_t> tags(n * TAG_SIZE);
+  for (long i = 0; i < n; ++i) {
+    uint64_t id = first + i;
+    memcpy(tags.data() + i * TAG_SIZE, &id, sizeof(id));
+  }
+  return tags;
+}
+
+template <size_t hashes>
+static void run(const char *name, double fp,
+                BFIndex index = BFIndex::SEEDED) {
+  long size = get_BF_size(hashes, MAX_DB_SIZE, fp);
+  auto present = make_tags(0, MAX_DB_SIZE);
+  auto absent = make_tags(MAX_DB_SIZE, ABSENT);
+  BloomFilter<TAG_SIZE, hashes> filter(size, index);
+
+  auto start = steady_clock::now();
+  for (long i = 0; i < MAX_DB_SIZE; ++i) {
+    filter.add_tag(present.data() + i * TAG_SIZE);
+  }
+  duration<double, std::nano> add_time = steady_clock::now() - start;
+
+  long hits = 0;
+  start = steady_clock::now();
+  for (long i = 0; i < MAX_DB_SIZE; ++i) {
+    hits += filter.might_contain(present.data() + i * TAG_SIZE);
+  }
+  duration<double, std::nano> hit_time = steady_clock::now() - start;
+
+  long false_positives = 0;
+  start = steady_clock::now();
+  for (long i = 0; i < ABSENT; ++i) {
+    false_positives += filter.might_contain(absent.data() + i * TAG_SIZE);
+  }
+  duration<double, std::nano> miss_time = steady_clock::now() - start;
+
+  std::cout << name << ", " << hashes << " hashes, " << size
+            << " bits: add "
+            << add_time.count() / MAX_DB_SIZE << " ns, hit "
+            << hit_time.count() / MAX_DB_SIZE << " ns, miss "
+            << miss_time.count() / ABSENT << " ns, found " << hits << "/"
+            << MAX_DB_SIZE << ", false positives " << false_positives << "/"
+            << ABSENT << " (target " << fp * ABSENT << ")" << std::endl;
+}
+
+static void run_digest_set() {
+  auto present = make_tags(0, MAX_DB_SIZE);
+  auto absent = make_tags(MAX_DB_SIZE, ABSENT);
+  DigestSet set;
+  set.reset(MAX_DB_SIZE);
+  uint8_t digest[DigestSet::DIGEST_LEN];
+
+  auto start = steady_clock::now();
+  for (long i = 0; i < MAX_DB_SIZE; ++i) {
+    DigestSet::digest(present.data() + i * TAG_SIZE, TAG_SIZE, digest);
+    set.insert(digest);
+  }
+  duration<double, std::nano> add_time = steady_clock::now() - start;
+
+  long hits = 0;
+  start = steady_clock::now();
+  for (long i = 0; i < MAX_DB_SIZE; ++i) {
+    DigestSet::digest(present.data() + i * TAG_SIZE, TAG_SIZE, digest);
+    hits += set.contains(digest);
+  }
+  duration<double, std::nano> hit_time = steady_clock::now() - start;
+
+  long false_positives = 0;
+  start = steady_clock::now();
+  for (long i = 0; i < ABSENT; ++i) {
+    DigestSet::digest(absent.data() + i * TAG_SIZE, TAG_SIZE, digest);
+    false_positives += set.contains(digest);
+  }
+  duration<double, std::nano> miss_time = steady_clock::now() - start;
+
+  std::cout << "DigestSet: add " << add_time.count() / MAX_DB_SIZE
+            << " ns, hit " << hit_time.count() / MAX_DB_SIZE << " ns, miss "
+            << miss_time.count() / ABSENT << " ns, found " << hits << "/"
+            << MAX_DB_SIZE << ", false positives " << false_positives << "/"
+            << ABSENT << std::endl;
+}
+
+int main() {
+  run<XSET_HASH>("BloomFilter", XSET_FP);
+  run<XSET_HASH>("BloomFilter double hash", XSET_FP, BFIndex::DOUBLE_HASH);
+  run_digest_set();
+  run<HASH_SIZE>("BloomFilter", GGM_FP);
+  run<HASH_SIZE>("BloomFilter double hash", GGM_FP, BFIndex::DOUBLE_HASH);
+  return 0;
+}
@@ -1,7 +1,63 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include "../BF/BloomFilter.h"
 
+using std::chrono::duration, std::chrono::steady_clock;
+
+// keys per second of add_tag/might_contain against their batch forms on a
+// filter of bits bits, far larger than L2 so most probes miss the cache
+static void bench_batch(long bits, BFIndex index) {
+  constexpr size_t KEY_LEN = 32, KEYS = 1 << 20;
+  std::vector<uint8_t> keys(KEYS * KEY_LEN);
+  for (size_t i = 0; i < KEYS; ++i) {
+    uint64_t value = i * 0x9E3779B97F4A7C15ULL;
+    memcpy(keys.data() + i * KEY_LEN, &value, sizeof(value));
+  }
+  auto rate = [](steady_clock::time_point start) {
+    return KEYS / duration<double>(steady_clock::now() - start).count();
+  };
+
+  BloomFilter<KEY_LEN, 20> single(bits, index), batch(bits, index);
+  auto start = steady_clock::now();
+  for (size_t i = 0; i < KEYS; ++i) {
+    single.add_tag(keys.data() + i * KEY_LEN);
+  }
+  double add_single = rate(start);
+  start = steady_clock::now();
+  batch.add_tag_batch(keys.data(), KEYS);
+  double add_batch = rate(start);
+
+  // look up the added keys shifted by half, so half of them are absent
+  const uint8_t *lookups = keys.data() + KEYS / 2 * KEY_LEN;
+  size_t count = KEYS / 2;
+  std::vector<bool> expected(count);
+  start = steady_clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    expected[i] = single.might_contain(lookups + i * KEY_LEN);
+  }
+  double contain_single = rate(start) / 2;
+  std::unique_ptr<bool[]> results(new bool[count]);
+  start = steady_clock::now();
+  batch.might_contain_batch(lookups, count, results.get());
+  double contain_batch = rate(start) / 2;
+  bool match = std::equal(expected.begin(), expected.end(), results.get()) &&
+               std::equal(single.get_words(),
+                          single.get_words() + (bits + 63) / 64,
+                          batch.get_words());
+
+  std::cout << (index == BFIndex::DOUBLE_HASH ? "double hash" : "seeded")
+            << ", " << bits / 8 / 1024 / 1024 << " MiB: add "
+            << add_single / 1e6 << " -> " << add_batch / 1e6
+            << " M keys/s, contains " << contain_single / 1e6 << " -> "
+            << contain_batch / 1e6 << " M keys/s, batch matches:"
+            << (match ? "yes" : "no") << std::endl;
+}
+
 int main() {
   auto BF_size = get_BF_size(20, 3, 0.0000001);
 
@@ -19,5 +75,16 @@ int main() {
   std::cout << "tag2:" << bf.might_contain(&tag2) << std::endl;
   std::cout << "tag3:" << bf.might_contain(&tag3) << std::endl;
 
+  // the set positions, enumerated a word at a time
+  std::cout << "set positions:" << bf.search().size() << " of "
+            << bf.count() << std::endl;
+
+  // the batch calls, hashing a group of keys and prefetching before probing
+  for (BFIndex index : {BFIndex::SEEDED, BFIndex::DOUBLE_HASH}) {
+    for (long bits : {1L << 27, 1L << 30}) {
+      bench_batch(bits, index);
+    }
+  }
+
   return 0;
 }
@@ -0,0 +1,112 @@
+#include "../Util/CryptoSuite.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Replays the symmetric work SSEClientHandler::update and
+// SSEServerHandler::search perform per entry with every suite, without the
+// network and the Bloom filter, so the suites can be compared in one binary.
+
+using std::chrono::duration, std::chrono::steady_clock;
+
+static constexpr int ENTRIES = 20000;
+// depth of the GGM tree for MAX_DB_SIZE entries at GGM_FP
+static constexpr int TREE_LEVEL = 22;
+// levels derived by the server below a cover node
+static constexpr int SEARCH_LEVEL = 8;
+
+template <typename Suite>
+static void derive(uint8_t *key, long offset, int levels, bool cipher_prg) {
+  uint8_t next_key[SM4_BLOCK_SIZE];
+  for (int k = levels; k > 0; --k) {
+    int k_bit = (offset >> (k - 1)) & 1;
+    if (cipher_prg) {
+      Suite::prg_derive(key, k_bit, next_key);
+    } else {
+      Suite::kdf((uint8_t *)&k_bit, sizeof(int), key, SM4_BLOCK_SIZE,
+                 next_key);
+    }
+    memcpy(key, next_key, SM4_BLOCK_SIZE);
+  }
+}
+
+template <typename Suite> static double bench_insert(bool cipher_prg) {
+  const uint8_t *key = (const uint8_t *)"0123456789123456";
+  const uint8_t *iv = (const uint8_t *)"0123456789123456";
+  const std::string keyword = "keyword";
+  uint8_t derived_keys[HASH_SIZE][SM4_BLOCK_SIZE];
+  uint8_t ciphertexts[HASH_SIZE][SM4_BLOCK_SIZE + sizeof(int)];
+  typename Suite::batch_item items[HASH_SIZE];
+
+  auto start = steady_clock::now();
+  for (int ind = 0; ind < ENTRIES; ++ind) {
+    // tag = H(w || ind)
+    uint8_t pair[16] = {};
+    memcpy(pair, keyword.c_str(), keyword.size());
+    memcpy(pair + keyword.size(), &ind, sizeof(int));
+    uint8_t tag[DIGEST_SIZE];
+    Suite::hash(pair, keyword.size() + sizeof(int), tag);
+    // one leaf key and one ciphertext per Bloom filter position
+    for (int i = 0; i < HASH_SIZE; ++i) {
+      uint32_t offset;
+      memcpy(&offset, tag + i * sizeof(offset), sizeof(offset));
+      memcpy(derived_keys[i], key, SM4_BLOCK_SIZE);
+      derive<Suite>(derived_keys[i], offset, TREE_LEVEL, cipher_prg);
+      memcpy(ciphertexts[i], iv, SM4_BLOCK_SIZE);
+      items[i] = {(const uint8_t *)&ind, static_cast<int>(sizeof(int)),
+                  derived_keys[i], ciphertexts[i],
+                  ciphertexts[i] + SM4_BLOCK_SIZE, 0};
+    }
+    Suite::encrypt_batch(items, HASH_SIZE);
+    // token and label
+    uint8_t token[DIGEST_SIZE];
+    uint8_t label[DIGEST_SIZE];
+    Suite::prf((const uint8_t *)keyword.c_str(), keyword.size(), key,
+               SM4_BLOCK_SIZE, token);
+    Suite::prf((const uint8_t *)&ind, sizeof(int), token, DIGEST_SIZE, label);
+  }
+  duration<double> elapsed = steady_clock::now() - start;
+  return ENTRIES / elapsed.count();
+}
+
+template <typename Suite> static double bench_search(bool cipher_prg) {
+  const uint8_t *root = (const uint8_t *)"0123456789123456";
+  const uint8_t *iv = (const uint8_t *)"0123456789123456";
+  uint8_t token[DIGEST_SIZE] = {};
+  uint8_t ciphertext[sizeof(int)] = {};
+  uint8_t plaintext[sizeof(int)];
+
+  auto start = steady_clock::now();
+  typename Suite::prf_key label_key;
+  Suite::prf_key_init(&label_key, token, DIGEST_SIZE);
+  for (int counter = 0; counter < ENTRIES; ++counter) {
+    uint8_t label[DIGEST_SIZE];
+    Suite::prf_key_digest(&label_key, (const uint8_t *)&counter, sizeof(int),
+                          label);
+    // derive the leaf key below its cover node and decrypt the id
+    uint8_t leaf_key[SM4_BLOCK_SIZE];
+    memcpy(leaf_key, root, SM4_BLOCK_SIZE);
+    derive<Suite>(leaf_key, counter, SEARCH_LEVEL, cipher_prg);
+    Suite::decrypt(ciphertext, sizeof(int), leaf_key, iv, plaintext);
+  }
+  Suite::prf_key_free(&label_key);
+  duration<double> elapsed = steady_clock::now() - start;
+  return ENTRIES / elapsed.count();
+}
+
+template <typename Suite> static void run() {
+  for (bool cipher_prg : {false, true}) {
+    long insert_rate = static_cast<long>(bench_insert<Suite>(cipher_prg));
+    long search_rate = static_cast<long>(bench_search<Suite>(cipher_prg));
+    std::cout << Suite::name << " suite, " << (cipher_prg ? "CIPHER" : "KDF")
+              << " PRG: insert " << insert_rate << " entries/s, search "
+              << search_rate << " entries/s" << std::endl;
+  }
+}
+
+int main() {
+  run<SMSuite>();
+  run<AESSuite>();
+  return 0;
+}
@@ -0,0 +1,133 @@
+#include "../BF/BloomFilter.h"
+#include "../GGM/GGMTree.h"
+#include "../Util/CryptoSuite.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Insert and search cost of the GGM tree as the deletion capacity grows past
+// 2^32 leaves. Inserts derive the leaf keys of a batch of entries at their
+// Bloom filter positions. Searches cover the leaves that survive a set of
+// deletions, derive the cover keys on the client and the leaf keys of the
+// entries below the cover on the server. The Bloom filter itself, one bit per
+// leaf, is not allocated; the cover is built from the sorted deleted leaves.
+
+using std::chrono::duration, std::chrono::steady_clock;
+using std::vector;
+
+static constexpr int ENTRIES = 2000;
+static constexpr int DELETIONS = 200;
+
+// the Bloom filter positions of keyword || ind in a tree of num_leaves leaves
+static std::array<long, HASH_SIZE> positions(const std::string &keyword,
+                                             int ind, long num_leaves) {
+  std::string pair = keyword;
+  pair.append(reinterpret_cast<const char *>(&ind), sizeof(int));
+  uint8_t tag[DIGEST_SIZE];
+  CryptoSuite::hash((const uint8_t *)pair.data(), pair.size(), tag);
+  return BloomFilter<32, HASH_SIZE>::get_index(tag, num_leaves);
+}
+
+static double elapsed_ms(steady_clock::time_point start) {
+  return duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+static void run(long capacity, GGMPrg prg) {
+  const uint8_t *root = (const uint8_t *)"0123456789123456";
+  long num_leaves = get_BF_size(HASH_SIZE, capacity, GGM_FP);
+  GGMTree tree(num_leaves, prg);
+  int level = tree.get_level();
+
+  // insert: the leaf keys of every position of a batch of entries
+  vector<long> leaves;
+  for (int ind = 0; ind < ENTRIES; ++ind) {
+    for (long leaf : positions("insert", ind, num_leaves)) {
+      leaves.emplace_back(leaf);
+    }
+  }
+  std::sort(leaves.begin(), leaves.end());
+  leaves.erase(std::unique(leaves.begin(), leaves.end()), leaves.end());
+  vector<uint8_t> leaf_keys(leaves.size() * SM4_BLOCK_SIZE);
+  auto start = steady_clock::now();
+  GGMTree::derive_leaf_keys(root, leaves.data(), leaves.size(), level,
+                            leaf_keys.data(), prg);
+  double insert_ms = elapsed_ms(start);
+
+  // search, client side: cover the gaps between the deleted leaves
+  vector<long> deleted;
+  for (int ind = 0; ind < DELETIONS; ++ind) {
+    for (long leaf : positions("delete", ind, num_leaves)) {
+      deleted.emplace_back(leaf);
+    }
+  }
+  std::sort(deleted.begin(), deleted.end());
+  deleted.erase(std::unique(deleted.begin(), deleted.end()), deleted.end());
+  start = steady_clock::now();
+  vector<GGMNode> cover;
+  long next = 0;
+  for (long leaf : deleted) {
+    tree.cover_range(next, leaf, cover);
+    next = leaf + 1;
+  }
+  tree.cover_range(next, num_leaves, cover);
+  vector<uint8_t *> key_ptrs(cover.size());
+  vector<long> offsets(cover.size());
+  vector<int> levels(cover.size());
+  for (size_t i = 0; i < cover.size(); ++i) {
+    memcpy(cover[i].key, root, SM4_BLOCK_SIZE);
+    key_ptrs[i] = cover[i].key;
+    offsets[i] = cover[i].index;
+    levels[i] = cover[i].level;
+  }
+  GGMTree::derive_keys_batch(key_ptrs.data(), offsets.data(), levels.data(),
+                             cover.size(), prg);
+  double cover_ms = elapsed_ms(start);
+
+  // search, server side: the key of every live leaf from its cover node,
+  // compared with the key the insert derived
+  vector<long> cover_starts(cover.size());
+  for (size_t i = 0; i < cover.size(); ++i) {
+    cover_starts[i] = cover[i].index << (level - cover[i].level);
+  }
+  bool match = true;
+  long live = 0;
+  start = steady_clock::now();
+  for (size_t i = 0; i < leaves.size(); ++i) {
+    if (std::binary_search(deleted.begin(), deleted.end(), leaves[i]))
+      continue;
+    size_t node = std::upper_bound(cover_starts.begin(), cover_starts.end(),
+                                   leaves[i]) -
+                  cover_starts.begin() - 1;
+    uint8_t key[SM4_BLOCK_SIZE];
+    memcpy(key, cover[node].key, SM4_BLOCK_SIZE);
+    GGMTree::derive_key_from_tree(key, leaves[i], level - cover[node].level,
+                                  0, prg);
+    match &= memcmp(key, leaf_keys.data() + i * SM4_BLOCK_SIZE,
+                    SM4_BLOCK_SIZE) == 0;
+    ++live;
+  }
+  double server_ms = elapsed_ms(start);
+
+  std::cout << (prg == GGMPrg::CIPHER ? "CIPHER" : "KDF") << " PRG, "
+            << capacity << " deletions: " << num_leaves << " leaves, level "
+            << level << ", largest leaf " << leaves.back() << std::endl;
+  std::cout << "  insert " << insert_ms * 1000 / ENTRIES << " us/entry, "
+            << "cover " << cover.size() << " nodes in " << cover_ms
+            << " ms, server " << server_ms * 1000 / std::max(live, 1L)
+            << " us/result, keys match:" << (match ? "yes" : "no")
+            << std::endl;
+}
+
+int main() {
+  // up to 2.9 * 10^10 leaves, past 2^34
+  for (GGMPrg prg : {GGMPrg::CIPHER, GGMPrg::KDF}) {
+    for (long capacity : {100000L, 10000000L, 300000000L, 1000000000L}) {
+      run(capacity, prg);
+    }
+  }
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "GGMTree.h"
+#include <cstring>
 #include <iostream>
 
 #define TREE_SIZE 8
@@ -6,15 +7,15 @@
 int main() {
   GGMTree tree(TREE_SIZE);
 
-  // add test nodes
-  std::vector<GGMNode> node_list;
-  node_list.emplace_back(GGMNode(0, tree.get_level()));
-  node_list.emplace_back(GGMNode(1, tree.get_level()));
-  node_list.emplace_back(GGMNode(3, tree.get_level()));
-  node_list.emplace_back(GGMNode(5, tree.get_level()));
+  // mark the live leaves 0, 1, 3 and 5
+  std::vector<uint64_t> live_leaves(1, 0);
+  for (int leaf : {0, 1, 3, 5}) {
+    live_leaves[0] |= 1ULL << leaf;
+  }
 
   // compute min coverage
-  std::vector<GGMNode> coverage = tree.min_coverage(node_list);
+  std::vector<GGMNode> coverage;
+  tree.min_coverage(live_leaves.data(), TREE_SIZE, coverage);
 
   // print the result
   std::cout << "The mini coverage node IDs are:" << std::endl;
@@ -23,5 +24,60 @@ int main() {
               << std::endl;
   }
 
+  // the same cover from the deleted leaves, as SSEClientHandler passes them
+  std::vector<uint64_t> deleted_leaves(1, ~live_leaves[0] & 0xff);
+  std::vector<GGMNode> deleted_coverage;
+  tree.min_coverage(deleted_leaves.data(), TREE_SIZE, deleted_coverage, false);
+  bool same = deleted_coverage.size() == coverage.size();
+  for (size_t i = 0; same && i < coverage.size(); ++i) {
+    same = deleted_coverage[i].index == coverage[i].index &&
+           deleted_coverage[i].level == coverage[i].level;
+  }
+  std::cout << "Coverage from deleted leaves matches:" << (same ? "yes" : "no")
+            << std::endl;
+
+  // derive the key of leaf 5 with both PRGs
+  for (GGMPrg prg : {GGMPrg::KDF, GGMPrg::CIPHER}) {
+    uint8_t key[SM4_BLOCK_SIZE] = "0123456789abcde";
+    GGMTree::derive_key_from_tree(key, 5, tree.get_level(), 0, prg);
+    std::cout << "Leaf 5 key with PRG " << static_cast<int>(prg) << ":";
+    for (uint8_t byte : key) {
+      std::cout << " " << static_cast<int>(byte);
+    }
+    std::cout << std::endl;
+  }
+
+  // derive the live leaves together and check them against one at a time
+  const long leaves[] = {0, 1, 3, 5};
+  for (GGMPrg prg : {GGMPrg::KDF, GGMPrg::CIPHER}) {
+    uint8_t root[SM4_BLOCK_SIZE] = "0123456789abcde";
+    uint8_t leaf_keys[4][SM4_BLOCK_SIZE];
+    GGMTree::derive_leaf_keys(root, leaves, 4, tree.get_level(),
+                              leaf_keys[0], prg);
+    bool match = true;
+    for (int i = 0; i < 4; ++i) {
+      uint8_t key[SM4_BLOCK_SIZE] = "0123456789abcde";
+      GGMTree::derive_key_from_tree(key, leaves[i], tree.get_level(), 0, prg);
+      match &= memcmp(key, leaf_keys[i], SM4_BLOCK_SIZE) == 0;
+    }
+    std::cout << "Shared-prefix leaf keys with PRG " << static_cast<int>(prg)
+              << " match:" << (match ? "yes" : "no") << std::endl;
+  }
+
+  // expand the whole tree and check it leaf by leaf
+  for (GGMPrg prg : {GGMPrg::KDF, GGMPrg::CIPHER}) {
+    uint8_t root[SM4_BLOCK_SIZE] = "0123456789abcde";
+    uint8_t leaf_keys[TREE_SIZE][SM4_BLOCK_SIZE];
+    GGMTree::derive_subtree_keys(root, tree.get_level(), leaf_keys[0], prg);
+    bool match = true;
+    for (long leaf = 0; leaf < TREE_SIZE; ++leaf) {
+      uint8_t key[SM4_BLOCK_SIZE] = "0123456789abcde";
+      GGMTree::derive_key_from_tree(key, leaf, tree.get_level(), 0, prg);
+      match &= memcmp(key, leaf_keys[leaf], SM4_BLOCK_SIZE) == 0;
+    }
+    std::cout << "Expanded tree with PRG " << static_cast<int>(prg)
+              << " matches:" << (match ? "yes" : "no") << std::endl;
+  }
+
   return 0;
 }
\ No newline at end of file
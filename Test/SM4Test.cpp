@@ -22,4 +22,61 @@ int main() {
 
   std::cout << "Output size:" << plaintext_len << std::endl;
   std::cout << "Recovered string:" << recover << std::endl;
+
+  // batch mode: every message has its own key and iv
+  const char *messages[] = {"first", "second message", "third"};
+  unsigned char keys[3][SM4_BLOCK_SIZE];
+  unsigned char batch_ciphertext[3][32];
+  unsigned char batch_recover[3][32] = {};
+  ctr_batch_item items[3];
+  for (int i = 0; i < 3; ++i) {
+    memcpy(keys[i], key, SM4_BLOCK_SIZE);
+    keys[i][0] = i;
+    items[i] = {(const unsigned char *)messages[i],
+                (int)strlen(messages[i]),
+                keys[i],
+                iv,
+                batch_ciphertext[i],
+                0};
+  }
+  sm4_encrypt_batch(items, 3);
+  for (int i = 0; i < 3; ++i) {
+    items[i].input = batch_ciphertext[i];
+    items[i].output = batch_recover[i];
+  }
+  sm4_decrypt_batch(items, 3);
+  for (int i = 0; i < 3; ++i) {
+    std::cout << "Batch recovered string " << i << ":" << batch_recover[i]
+              << std::endl;
+  }
+
+  // multi-key kernel: every block under its own key, checked against the
+  // OpenSSL SM4 used by sm4_encrypt (CTR keystream of a zero counter block)
+  const int blocks = 37;
+  unsigned char block_keys[blocks][SM4_BLOCK_SIZE];
+  unsigned char block_inputs[blocks][SM4_BLOCK_SIZE];
+  unsigned char block_outputs[blocks][SM4_BLOCK_SIZE];
+  const unsigned char *key_ptrs[blocks];
+  const unsigned char *input_ptrs[blocks];
+  unsigned char *output_ptrs[blocks];
+  for (int i = 0; i < blocks; ++i) {
+    for (int j = 0; j < SM4_BLOCK_SIZE; ++j) {
+      block_keys[i][j] = i * 31 + j;
+      block_inputs[i][j] = i * 17 + j * 3;
+    }
+    key_ptrs[i] = block_keys[i];
+    input_ptrs[i] = block_inputs[i];
+    output_ptrs[i] = block_outputs[i];
+  }
+  sm4_encrypt_blocks(key_ptrs, input_ptrs, output_ptrs, blocks);
+  bool match = true;
+  for (int i = 0; i < blocks; ++i) {
+    unsigned char zeros[SM4_BLOCK_SIZE] = {};
+    unsigned char expected[SM4_BLOCK_SIZE];
+    sm4_encrypt(zeros, SM4_BLOCK_SIZE, block_keys[i], block_inputs[i],
+                expected);
+    match &= memcmp(expected, block_outputs[i], SM4_BLOCK_SIZE) == 0;
+  }
+  std::cout << "Multi-key SM4 matches OpenSSL:" << (match ? "yes" : "no")
+            << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "Core/SSEServerHandler.h"
+#include "CryptoSuite.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Searches an in-process server handler with covers that leave out some
+// positions of an entry, the way deletions of other entries do. The entries
+// are built as SSEClientHandler builds them.
+
+#define TREE_SIZE 1024
+
+static const uint8_t *root_key = (const uint8_t *)"0123456789123456";
+static const uint8_t *iv = (const uint8_t *)"0123456789123456";
+static uint8_t token[DIGEST_SIZE] = "search token of the keyword";
+
+// the sorted positions of a tag
+static std::array<long, HASH_SIZE> positions(const uint8_t *tag) {
+  auto search_pos = BloomFilter<32, HASH_SIZE>::get_index(tag, TREE_SIZE);
+  std::sort(search_pos.begin(), search_pos.end());
+  return search_pos;
+}
+
+// the entry of id with tag as the counter-th entry of the keyword, id
+// encrypted under the key of each of its positions
+static SSEServerHandler::Entry make_entry(int counter, int id,
+                                          const uint8_t *tag, int level) {
+  std::vector<std::string> ciphertext_list;
+  for (long pos : positions(tag)) {
+    uint8_t key[SM4_BLOCK_SIZE];
+    memcpy(key, root_key, SM4_BLOCK_SIZE);
+    GGMTree::derive_key_from_tree(key, pos, level, 0);
+    std::string ciphertext(SM4_BLOCK_SIZE + sizeof(int), '\0');
+    memcpy(ciphertext.data(), iv, SM4_BLOCK_SIZE);
+    CryptoSuite::encrypt((const uint8_t *)&id, sizeof(int), key, iv,
+                         (uint8_t *)ciphertext.data() + SM4_BLOCK_SIZE);
+    ciphertext_list.emplace_back(std::move(ciphertext));
+  }
+  CryptoSuite::prf_key label_key;
+  CryptoSuite::prf_key_init(&label_key, token, DIGEST_SIZE);
+  const uint8_t *input = (const uint8_t *)&counter;
+  int input_len = sizeof(int);
+  uint8_t label[DIGEST_SIZE];
+  CryptoSuite::prf_key_digest_batch(&label_key, &input, &input_len, 1, label);
+  CryptoSuite::prf_key_free(&label_key);
+  return {std::string((char *)label, DIGEST_SIZE),
+          std::string((const char *)tag, DIGEST_SIZE),
+          std::move(ciphertext_list)};
+}
+
+// the cover of every leaf except the deleted ones, with keys
+static std::vector<GGMNode> cover_without(const GGMTree &tree,
+                                          std::vector<long> deleted) {
+  std::sort(deleted.begin(), deleted.end());
+  std::vector<GGMNode> cover;
+  long next = 0;
+  for (long leaf : deleted) {
+    tree.cover_range(next, leaf, cover);
+    next = leaf + 1;
+  }
+  tree.cover_range(next, TREE_SIZE, cover);
+  for (GGMNode &node : cover) {
+    memcpy(node.key, root_key, SM4_BLOCK_SIZE);
+    GGMTree::derive_key_from_tree(node.key, node.index, node.level, 0);
+  }
+  return cover;
+}
+
+int main() {
+  GGMTree tree(TREE_SIZE);
+  int level = tree.get_level();
+  SSEServerHandler server(TREE_SIZE);
+
+  // three entries of one keyword, ids 10, 11 and 12
+  uint8_t tags[3][DIGEST_SIZE];
+  for (int i = 0; i < 3; ++i) {
+    memset(tags[i], 'a' + i, DIGEST_SIZE);
+    auto [label, tag, ciphertext_list] = make_entry(i, 10 + i, tags[i], level);
+    server.add_entries(label, tag, std::move(ciphertext_list));
+  }
+  auto middle = positions(tags[1]);
+
+  auto search = [&](const std::vector<long> &deleted) {
+    std::vector<GGMNode> cover = cover_without(tree, deleted);
+    std::vector<int> ids;
+    for (const std::string &res : server.search(token, cover, level)) {
+      ids.emplace_back(*(const int *)res.data());
+    }
+    std::sort(ids.begin(), ids.end());
+    std::string printed;
+    for (int id : ids) {
+      printed += std::to_string(id) + " ";
+    }
+    return printed;
+  };
+
+  std::cout << "nothing deleted: " << search({}) << std::endl;
+  // the middle entry loses its first position, or one in the middle of
+  // its positions, to other deletions and is still live
+  std::cout << "first position of id 11 deleted: " << search({middle[0]})
+            << std::endl;
+  std::cout << "middle position of id 11 deleted: "
+            << search({middle[HASH_SIZE / 2]}) << std::endl;
+  // id 11 itself deleted, all of its positions are gone
+  std::cout << "id 11 deleted: "
+            << search(std::vector<long>(middle.begin(), middle.end()))
+            << std::endl;
+
+  // a batch with an invalid entry adds none of its entries
+  uint8_t tag13[DIGEST_SIZE];
+  memset(tag13, 'd', DIGEST_SIZE);
+  std::vector<SSEServerHandler::Entry> batch = {
+      make_entry(3, 13, tag13, level), make_entry(4, 14, tag13, level)};
+  std::get<0>(batch[1]).resize(DIGEST_SIZE / 2);
+  std::cout << "batch with a short label added: "
+            << server.add_entries_batch(batch) << ", found: " << search({})
+            << std::endl;
+  batch.pop_back();
+  std::cout << "valid batch added: " << server.add_entries_batch(batch)
+            << ", found: " << search({}) << std::endl;
+
+  // covers in the legacy node list that overlap or leave the tree find
+  // nothing
+  std::vector<GGMNode> cover = cover_without(tree, {});
+  std::vector<GGMNode> overlapping = cover;
+  overlapping.emplace_back(cover.front());
+  std::vector<GGMNode> outside = cover;
+  outside.front().level = level + 1;
+  std::cout << "valid node list: "
+            << server.search(token, cover, level).size() << std::endl;
+  std::cout << "overlapping node list: "
+            << server.search(token, overlapping, level).size() << std::endl;
+  std::cout << "node below the leaves: "
+            << server.search(token, outside, level).size() << std::endl;
+  return 0;
+}
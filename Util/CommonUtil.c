@@ -1,82 +1,174 @@
 #include "CommonUtil.h"
 #include <openssl/evp.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
-int sm4_encrypt(const unsigned char *plaintext, int plaintext_len,
-                const unsigned char *key, const unsigned char *iv,
-                unsigned char *ciphertext) {
-  EVP_CIPHER_CTX *ctx;
+/* algorithm objects are fetched once per process and shared by all threads */
+static EVP_CIPHER *sm4_ctr_cipher;
+static EVP_CIPHER *aes128_ctr_cipher;
+static EVP_CIPHER *aes128_ecb_cipher;
+static EVP_MD *sm3_md;
+static EVP_MD *md5_md;
+static EVP_MD *sha256_md;
+
+/* contexts are owned by a single thread and re-keyed on every call */
+typedef struct {
+  EVP_CIPHER_CTX *sm4_ctx;
+  EVP_CIPHER_CTX *aes_ctx;
+  EVP_CIPHER_CTX *aes_prg_ctx;
+  EVP_MD_CTX *md_ctx;
+} crypto_contexts;
+
+static pthread_once_t crypto_once = PTHREAD_ONCE_INIT;
+static pthread_key_t crypto_key;
+static _Thread_local crypto_contexts *thread_contexts;
+
+static void free_contexts(void *ptr) {
+  crypto_contexts *contexts = ptr;
+  EVP_CIPHER_CTX_free(contexts->sm4_ctx);
+  EVP_CIPHER_CTX_free(contexts->aes_ctx);
+  EVP_CIPHER_CTX_free(contexts->aes_prg_ctx);
+  EVP_MD_CTX_free(contexts->md_ctx);
+  free(contexts);
+}
+
+static void fetch_algorithms(void) {
+  sm4_ctr_cipher = EVP_CIPHER_fetch(NULL, "SM4-CTR", NULL);
+  aes128_ctr_cipher = EVP_CIPHER_fetch(NULL, "AES-128-CTR", NULL);
+  aes128_ecb_cipher = EVP_CIPHER_fetch(NULL, "AES-128-ECB", NULL);
+  sm3_md = EVP_MD_fetch(NULL, "SM3", NULL);
+  md5_md = EVP_MD_fetch(NULL, "MD5", NULL);
+  sha256_md = EVP_MD_fetch(NULL, "SHA256", NULL);
+  /* release the contexts of a thread when it exits */
+  pthread_key_create(&crypto_key, free_contexts);
+}
+
+/* bind the cipher once, later calls only install the key and iv */
+static EVP_CIPHER_CTX *new_cipher_ctx(const EVP_CIPHER *cipher) {
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, 1);
+  EVP_CIPHER_CTX_set_padding(ctx, 0);
+  return ctx;
+}
 
+static crypto_contexts *get_contexts(void) {
+  if (thread_contexts)
+    return thread_contexts;
+
+  pthread_once(&crypto_once, fetch_algorithms);
+
+  crypto_contexts *contexts = malloc(sizeof(crypto_contexts));
+  contexts->sm4_ctx = new_cipher_ctx(sm4_ctr_cipher);
+  contexts->aes_ctx = new_cipher_ctx(aes128_ctr_cipher);
+  contexts->aes_prg_ctx = new_cipher_ctx(aes128_ecb_cipher);
+  contexts->md_ctx = EVP_MD_CTX_new();
+  pthread_setspecific(crypto_key, contexts);
+
+  thread_contexts = contexts;
+  return contexts;
+}
+
+static int ctr_crypt(EVP_CIPHER_CTX *ctx, const unsigned char *input,
+                     int input_len, const unsigned char *key,
+                     const unsigned char *iv, unsigned char *output, int enc) {
   int len = 0;
 
-  int ciphertext_len;
+  int output_len;
 
-  /* Create and initialise the context */
-  ctx = EVP_CIPHER_CTX_new();
+  /* Re-key the cached context, this also resets the counter state */
+  EVP_CipherInit_ex(ctx, NULL, NULL, key, iv, enc);
 
-  /* Initialise the encryption operation. */
-  EVP_EncryptInit_ex(ctx, EVP_sm4_ctr(), NULL, key, iv);
+  /* Process the message */
+  EVP_CipherUpdate(ctx, output, &len, input, input_len);
+  output_len = len;
 
-  /* Encrypt the message */
-  EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len);
-  ciphertext_len = len;
+  /* Finalise the operation */
+  EVP_CipherFinal_ex(ctx, output + len, &len);
+  output_len += len;
 
-  /* Finalise the encryption */
-  EVP_EncryptFinal_ex(ctx, ciphertext + len, &len);
-  ciphertext_len += len;
+  return output_len;
+}
 
-  /* Clean up */
-  EVP_CIPHER_CTX_free(ctx);
+static void ctr_crypt_batch(EVP_CIPHER_CTX *ctx, ctr_batch_item *items,
+                            size_t count, int enc) {
+  for (size_t i = 0; i < count; ++i) {
+    ctr_batch_item *item = &items[i];
+    item->output_len = ctr_crypt(ctx, item->input, item->input_len, item->key,
+                                 item->iv, item->output, enc);
+  }
+}
 
-  return ciphertext_len;
+int sm4_encrypt(const unsigned char *plaintext, int plaintext_len,
+                const unsigned char *key, const unsigned char *iv,
+                unsigned char *ciphertext) {
+  return ctr_crypt(get_contexts()->sm4_ctx, plaintext, plaintext_len, key, iv,
+                   ciphertext, 1);
 }
 
 int sm4_decrypt(const unsigned char *ciphertext, int ciphertext_len,
                 const unsigned char *key, const unsigned char *iv,
                 unsigned char *plaintext) {
-  EVP_CIPHER_CTX *ctx;
-
-  int len = 0;
-
-  int plaintext_len;
+  return ctr_crypt(get_contexts()->sm4_ctx, ciphertext, ciphertext_len, key,
+                   iv, plaintext, 0);
+}
 
-  /* Create and initialise the context */
-  ctx = EVP_CIPHER_CTX_new();
+/* CTR is its own inverse, both directions run on the multi-key kernel */
+void sm4_encrypt_batch(ctr_batch_item *items, size_t count) {
+  sm4_ctr_batch(items, count);
+}
 
-  /* Initialise the decryption operation. */
-  EVP_DecryptInit_ex(ctx, EVP_sm4_ctr(), NULL, key, iv);
+void sm4_decrypt_batch(ctr_batch_item *items, size_t count) {
+  sm4_ctr_batch(items, count);
+}
 
-  /* decrypt the message */
-  EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len);
-  plaintext_len = len;
+int aes128_encrypt(const unsigned char *plaintext, int plaintext_len,
+                   const unsigned char *key, const unsigned char *iv,
+                   unsigned char *ciphertext) {
+  return ctr_crypt(get_contexts()->aes_ctx, plaintext, plaintext_len, key, iv,
+                   ciphertext, 1);
+}
 
-  /* Finalise the encryption */
-  EVP_DecryptFinal_ex(ctx, plaintext + len, &len);
-  plaintext_len += len;
+int aes128_decrypt(const unsigned char *ciphertext, int ciphertext_len,
+                   const unsigned char *key, const unsigned char *iv,
+                   unsigned char *plaintext) {
+  return ctr_crypt(get_contexts()->aes_ctx, ciphertext, ciphertext_len, key,
+                   iv, plaintext, 0);
+}
 
-  /* Clean up */
-  EVP_CIPHER_CTX_free(ctx);
+void aes128_encrypt_batch(ctr_batch_item *items, size_t count) {
+  ctr_crypt_batch(get_contexts()->aes_ctx, items, count, 1);
+}
 
-  return plaintext_len;
+void aes128_decrypt_batch(ctr_batch_item *items, size_t count) {
+  ctr_crypt_batch(get_contexts()->aes_ctx, items, count, 0);
 }
 
-void sm3_digest(const unsigned char *plaintext, int plaintext_len,
-                unsigned char *digest) {
+static void md_digest(EVP_MD_CTX *mdctx, const EVP_MD *md,
+                      const unsigned char *plaintext, int plaintext_len,
+                      unsigned char *digest) {
   unsigned int digest_len;
-  EVP_MD_CTX *mdctx;
 
-  /* Create and initialise the context */
-  mdctx = EVP_MD_CTX_new();
-  EVP_DigestInit_ex(mdctx, EVP_sm3(), NULL);
+  /* Initialise the cached context */
+  EVP_DigestInit_ex(mdctx, md, NULL);
 
   /* compute the digest */
   EVP_DigestUpdate(mdctx, plaintext, plaintext_len);
 
   /* Finalise the digest */
   EVP_DigestFinal_ex(mdctx, digest, &digest_len);
+}
+
+void sm3_digest(const unsigned char *plaintext, int plaintext_len,
+                unsigned char *digest) {
+  EVP_MD_CTX *mdctx = get_contexts()->md_ctx;
+  md_digest(mdctx, sm3_md, plaintext, plaintext_len, digest);
+}
 
-  /* Clean up */
-  EVP_MD_CTX_free(mdctx);
+void sha256_digest(const unsigned char *plaintext, int plaintext_len,
+                   unsigned char *digest) {
+  EVP_MD_CTX *mdctx = get_contexts()->md_ctx;
+  md_digest(mdctx, sha256_md, plaintext, plaintext_len, digest);
 }
 
 unsigned int hmac_digest(const unsigned char *plaintext, int plaintext_len,
@@ -87,21 +179,176 @@ unsigned int hmac_digest(const unsigned char *plaintext, int plaintext_len,
   return digest_len;
 }
 
+unsigned int hmac_sha256_digest(const unsigned char *plaintext,
+                                int plaintext_len, const unsigned char *key,
+                                int key_len, unsigned char *digest) {
+  unsigned int digest_len;
+  HMAC(EVP_sha256(), key, key_len, plaintext, plaintext_len, digest,
+       &digest_len);
+  return digest_len;
+}
+
+static void hmac_state_init(hmac_key *state, const EVP_MD *md,
+                            const unsigned char *key, int key_len) {
+  unsigned char block[SM3_BLOCK_SIZE] = {0};
+  unsigned char pad[SM3_BLOCK_SIZE];
+  EVP_MD_CTX *mdctx = get_contexts()->md_ctx;
+
+  /* keys longer than one block are hashed first (RFC 2104) */
+  if (key_len > SM3_BLOCK_SIZE) {
+    md_digest(mdctx, md, key, key_len, block);
+  } else {
+    memcpy(block, key, key_len);
+  }
+
+  /* absorb key ^ ipad into the inner state */
+  for (int i = 0; i < SM3_BLOCK_SIZE; ++i)
+    pad[i] = block[i] ^ 0x36;
+  state->inner = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(state->inner, md, NULL);
+  EVP_DigestUpdate(state->inner, pad, SM3_BLOCK_SIZE);
+  state->multi_lane = md == sm3_md;
+  if (state->multi_lane)
+    sm3_block_state(pad, state->inner_cv);
+
+  /* absorb key ^ opad into the outer state */
+  for (int i = 0; i < SM3_BLOCK_SIZE; ++i)
+    pad[i] = block[i] ^ 0x5c;
+  state->outer = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(state->outer, md, NULL);
+  EVP_DigestUpdate(state->outer, pad, SM3_BLOCK_SIZE);
+  if (state->multi_lane)
+    sm3_block_state(pad, state->outer_cv);
+
+  /* clean the key material */
+  memset(block, 0, SM3_BLOCK_SIZE);
+  memset(pad, 0, SM3_BLOCK_SIZE);
+}
+
+void hmac_key_init(hmac_key *state, const unsigned char *key, int key_len) {
+  /* make sure the digests are fetched before sm3_md is read */
+  get_contexts();
+  hmac_state_init(state, sm3_md, key, key_len);
+}
+
+void hmac_sha256_key_init(hmac_key *state, const unsigned char *key,
+                          int key_len) {
+  /* make sure the digests are fetched before sha256_md is read */
+  get_contexts();
+  hmac_state_init(state, sha256_md, key, key_len);
+}
+
+unsigned int hmac_key_digest(const hmac_key *state,
+                             const unsigned char *plaintext, int plaintext_len,
+                             unsigned char *digest) {
+  unsigned char inner_digest[DIGEST_SIZE];
+  unsigned int digest_len;
+  EVP_MD_CTX *mdctx = get_contexts()->md_ctx;
+
+  /* H((K ^ ipad) || m) */
+  EVP_MD_CTX_copy_ex(mdctx, state->inner);
+  EVP_DigestUpdate(mdctx, plaintext, plaintext_len);
+  EVP_DigestFinal_ex(mdctx, inner_digest, &digest_len);
+
+  /* H((K ^ opad) || H((K ^ ipad) || m)) */
+  EVP_MD_CTX_copy_ex(mdctx, state->outer);
+  EVP_DigestUpdate(mdctx, inner_digest, digest_len);
+  EVP_DigestFinal_ex(mdctx, digest, &digest_len);
+
+  return digest_len;
+}
+
+void hmac_key_free(hmac_key *state) {
+  EVP_MD_CTX_free(state->inner);
+  EVP_MD_CTX_free(state->outer);
+  state->inner = NULL;
+  state->outer = NULL;
+  memset(state->inner_cv, 0, sizeof(state->inner_cv));
+  memset(state->outer_cv, 0, sizeof(state->outer_cv));
+}
+
 unsigned int key_derivation(const unsigned char *plaintext, int plaintext_len,
                             const unsigned char *key, int key_len,
                             unsigned char *digest) {
   unsigned char sm3_hmac_digest[DIGEST_SIZE];
   hmac_digest(plaintext, plaintext_len, key, key_len, sm3_hmac_digest);
 
-  unsigned int digest_len;
   // shrink the digest to 16 bytes use md5
-  EVP_MD_CTX *mdctx;
-  mdctx = EVP_MD_CTX_new();
-  EVP_DigestInit_ex(mdctx, EVP_md5(), NULL);
-  EVP_DigestUpdate(mdctx, sm3_hmac_digest, DIGEST_SIZE);
-  EVP_DigestFinal_ex(mdctx, digest, &digest_len);
-  EVP_MD_CTX_free(mdctx);
+  EVP_MD_CTX *mdctx = get_contexts()->md_ctx;
+  md_digest(mdctx, md5_md, sm3_hmac_digest, DIGEST_SIZE, digest);
   // clean the intermediate result to avoid side channel attack
   memset(sm3_hmac_digest, 0, DIGEST_SIZE);
-  return digest_len;
+  return SM4_BLOCK_SIZE;
+}
+
+unsigned int sha256_key_derivation(const unsigned char *plaintext,
+                                   int plaintext_len, const unsigned char *key,
+                                   int key_len, unsigned char *digest) {
+  unsigned char sha256_hmac_digest[DIGEST_SIZE];
+  hmac_sha256_digest(plaintext, plaintext_len, key, key_len,
+                     sha256_hmac_digest);
+
+  /* keep the first 16 bytes as the derived key */
+  memcpy(digest, sha256_hmac_digest, SM4_BLOCK_SIZE);
+  memset(sha256_hmac_digest, 0, DIGEST_SIZE);
+  return SM4_BLOCK_SIZE;
+}
+
+/* the two constant blocks encrypted by the block cipher based GGM PRG */
+static const unsigned char prg_blocks[2 * SM4_BLOCK_SIZE] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+
+static void ecb_prg(EVP_CIPHER_CTX *ctx, const unsigned char *key,
+                    const unsigned char *blocks, int blocks_len,
+                    unsigned char *output) {
+  int len;
+  EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, 1);
+  EVP_CipherUpdate(ctx, output, &len, blocks, blocks_len);
+}
+
+void sm4_key_expansion(const unsigned char *key, unsigned char *children) {
+  const unsigned char *keys[2] = {key, key};
+  const unsigned char *inputs[2] = {prg_blocks, prg_blocks + SM4_BLOCK_SIZE};
+  unsigned char *outputs[2] = {children, children + SM4_BLOCK_SIZE};
+  sm4_encrypt_blocks(keys, inputs, outputs, 2);
+}
+
+void sm4_key_derivation(const unsigned char *key, int bit,
+                        unsigned char *child) {
+  const unsigned char *input = prg_blocks + bit * SM4_BLOCK_SIZE;
+  sm4_encrypt_blocks(&key, &input, &child, 1);
+}
+
+/* keys handed to the SM4 kernel per call in sm4_key_derivation_batch */
+#define PRG_CHUNK 64
+
+void sm4_key_derivation_batch(unsigned char *const *keys, const int *bits,
+                              size_t count) {
+  const unsigned char *inputs[PRG_CHUNK];
+  /* the kernel reads every key before it writes the children over them */
+  for (size_t i = 0; i < count; i += PRG_CHUNK) {
+    size_t n = count - i < PRG_CHUNK ? count - i : PRG_CHUNK;
+    for (size_t j = 0; j < n; ++j)
+      inputs[j] = prg_blocks + bits[i + j] * SM4_BLOCK_SIZE;
+    sm4_encrypt_blocks((const unsigned char *const *)keys + i, inputs,
+                       keys + i, n);
+  }
+}
+
+void aes128_key_expansion(const unsigned char *key, unsigned char *children) {
+  ecb_prg(get_contexts()->aes_prg_ctx, key, prg_blocks, 2 * SM4_BLOCK_SIZE,
+          children);
+}
+
+void aes128_key_derivation(const unsigned char *key, int bit,
+                           unsigned char *child) {
+  ecb_prg(get_contexts()->aes_prg_ctx, key, prg_blocks + bit * SM4_BLOCK_SIZE,
+          SM4_BLOCK_SIZE, child);
+}
+
+void aes128_key_derivation_batch(unsigned char *const *keys, const int *bits,
+                                 size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    aes128_key_derivation(keys[i], bits[i], keys[i]);
 }
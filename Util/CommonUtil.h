@@ -5,9 +5,14 @@
 #include <openssl/hmac.h>
 #include <openssl/rand.h>
 #include <openssl/sha.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define SM4_BLOCK_SIZE 16
+#define SM3_BLOCK_SIZE 64
 #define DIGEST_SIZE 32
+// longest message whose padded SM3 input fits in one block
+#define SM3_SINGLE_BLOCK_MAX 55
 #define MAX_DB_SIZE 100000
 #define HASH_SIZE 5
 #define GGM_FP 0.0001
@@ -22,15 +27,132 @@ int sm4_decrypt(const unsigned char *ciphertext, int ciphertext_len,
                 const unsigned char *key, const unsigned char *iv,
                 unsigned char *plaintext);
 
+// one independent CTR-mode message of a batch, output_len is filled in by the
+// batch call
+typedef struct {
+  const unsigned char *input;
+  int input_len;
+  const unsigned char *key;
+  const unsigned char *iv;
+  unsigned char *output;
+  int output_len;
+} ctr_batch_item;
+
+void sm4_encrypt_batch(ctr_batch_item *items, size_t count);
+
+void sm4_decrypt_batch(ctr_batch_item *items, size_t count);
+
+// in-tree SM4 for many keys at once: outputs[i] = SM4_keys[i](inputs[i]) for
+// single blocks. AVX-512 or AVX2 kernels are picked from the CPU features on
+// first use, with a portable table-based fallback. outputs[i] may alias
+// keys[i] or inputs[i].
+void sm4_encrypt_blocks(const unsigned char *const *keys,
+                        const unsigned char *const *inputs,
+                        unsigned char *const *outputs, size_t count);
+
+// SM4-CTR over a batch of independent messages on sm4_encrypt_blocks, used
+// by sm4_encrypt_batch and sm4_decrypt_batch
+void sm4_ctr_batch(ctr_batch_item *items, size_t count);
+
+// AES-128-CTR with the same key, iv and block sizes as the SM4 functions
+int aes128_encrypt(const unsigned char *plaintext, int plaintext_len,
+                   const unsigned char *key, const unsigned char *iv,
+                   unsigned char *ciphertext);
+
+int aes128_decrypt(const unsigned char *ciphertext, int ciphertext_len,
+                   const unsigned char *key, const unsigned char *iv,
+                   unsigned char *plaintext);
+
+void aes128_encrypt_batch(ctr_batch_item *items, size_t count);
+
+void aes128_decrypt_batch(ctr_batch_item *items, size_t count);
+
 void sm3_digest(const unsigned char *plaintext, int plaintext_len,
                 unsigned char *digest);
 
+void sha256_digest(const unsigned char *plaintext, int plaintext_len,
+                   unsigned char *digest);
+
 unsigned int hmac_digest(const unsigned char *plaintext, int plaintext_len,
                          const unsigned char *key, int key_len,
                          unsigned char *digest);
 
+unsigned int hmac_sha256_digest(const unsigned char *plaintext,
+                                int plaintext_len, const unsigned char *key,
+                                int key_len, unsigned char *digest);
+
+// SM3 of count independent messages, digest i is written to
+// digests + i * DIGEST_SIZE. Messages of at most SM3_SINGLE_BLOCK_MAX bytes
+// are hashed several at a time by a multi-lane kernel chosen from the CPU
+// features at load time, longer ones go through sm3_digest.
+void sm3_digest_batch(const unsigned char *const *plaintexts,
+                      const int *plaintext_lens, size_t count,
+                      unsigned char *digests);
+
+// SM3 chaining value after compressing one block from the standard IV
+void sm3_block_state(const unsigned char block[SM3_BLOCK_SIZE],
+                     uint32_t cv[8]);
+
+// HMAC state keyed once: the inner and outer hash states already absorbed
+// the padded key, so each message only costs the two final compressions. The
+// state is read-only after init and can be shared between threads. SM3 and
+// SHA-256 share the 64-byte block, hmac_key_digest serves both. HMAC-SM3
+// keys also keep the raw chaining values for the multi-lane kernel.
+typedef struct {
+  EVP_MD_CTX *inner;
+  EVP_MD_CTX *outer;
+  uint32_t inner_cv[8];
+  uint32_t outer_cv[8];
+  int multi_lane;
+} hmac_key;
+
+void hmac_key_init(hmac_key *state, const unsigned char *key, int key_len);
+
+void hmac_sha256_key_init(hmac_key *state, const unsigned char *key,
+                          int key_len);
+
+unsigned int hmac_key_digest(const hmac_key *state,
+                             const unsigned char *plaintext, int plaintext_len,
+                             unsigned char *digest);
+
+// hmac_key_digest of count independent messages, laid out as in
+// sm3_digest_batch
+void hmac_key_digest_batch(const hmac_key *state,
+                           const unsigned char *const *plaintexts,
+                           const int *plaintext_lens, size_t count,
+                           unsigned char *digests);
+
+void hmac_key_free(hmac_key *state);
+
 unsigned int key_derivation(const unsigned char *plaintext, int plaintext_len,
                             const unsigned char *key, int key_len,
                             unsigned char *digest);
 
+// HMAC-SHA256 truncated to a 16-byte key
+unsigned int sha256_key_derivation(const unsigned char *plaintext,
+                                   int plaintext_len, const unsigned char *key,
+                                   int key_len, unsigned char *digest);
+
+// length-doubling GGM PRG on one SM4 key: children = SM4_key(0) || SM4_key(1),
+// i.e. the left child followed by the right child (2 * SM4_BLOCK_SIZE bytes)
+void sm4_key_expansion(const unsigned char *key, unsigned char *children);
+
+// one half of sm4_key_expansion, bit selects the left (0) or right (1) child
+void sm4_key_derivation(const unsigned char *key, int bit,
+                        unsigned char *child);
+
+// sm4_key_derivation of count independent keys in place, keys[i] is replaced
+// by its child selected by bits[i]
+void sm4_key_derivation_batch(unsigned char *const *keys, const int *bits,
+                              size_t count);
+
+// the same PRG on AES-128
+void aes128_key_expansion(const unsigned char *key, unsigned char *children);
+
+void aes128_key_derivation(const unsigned char *key, int bit,
+                           unsigned char *child);
+
+void aes128_key_derivation_batch(unsigned char *const *keys, const int *bits,
+                                 size_t count);
+
 #endif // AURA_COMMONUTIL_H
@@ -0,0 +1,189 @@
+#ifndef AURA_CRYPTOSUITE_H
+#define AURA_CRYPTOSUITE_H
+
+extern "C" {
+#include "CommonUtil.h"
+}
+
+#include <cstddef>
+#include <cstdint>
+
+// Symmetric primitives used by the SSE layer. Every suite exposes the same
+// static interface over 16-byte keys and blocks and 32-byte digests, so the
+// handlers, the GGM tree and the CQ/CQS clients never name an algorithm:
+//   encrypt / decrypt          CTR mode, returns the output length
+//   encrypt_batch / ..._batch  independent CTR messages in one call
+//   hash / hash_batch          tag digest of keyword || id
+//   prf                        keyed PRF for tokens, labels and K_w
+//   prf_key_*                  the same PRF with a pre-keyed state, the batch
+//                              variant writes DIGEST_SIZE bytes per message
+//   kdf                        hash-based GGM derivation (GGMPrg::KDF)
+//   prg_derive / ..._batch     block cipher GGM derivation (GGMPrg::CIPHER),
+//                              the batch variant works in place
+// The suite is chosen at compile time with SDSSE_CRYPTO_SUITE, client and
+// server must be built with the same one.
+
+// SM4-CTR, SM3, HMAC-SM3 and MD5(HMAC-SM3), the original construction
+struct SMSuite {
+  static constexpr const char *name = "SM";
+  using batch_item = ctr_batch_item;
+  using prf_key = hmac_key;
+
+  static int encrypt(const uint8_t *plaintext, int plaintext_len,
+                     const uint8_t *key, const uint8_t *iv,
+                     uint8_t *ciphertext) {
+    return sm4_encrypt(plaintext, plaintext_len, key, iv, ciphertext);
+  }
+
+  static int decrypt(const uint8_t *ciphertext, int ciphertext_len,
+                     const uint8_t *key, const uint8_t *iv,
+                     uint8_t *plaintext) {
+    return sm4_decrypt(ciphertext, ciphertext_len, key, iv, plaintext);
+  }
+
+  static void encrypt_batch(batch_item *items, size_t count) {
+    sm4_encrypt_batch(items, count);
+  }
+
+  static void decrypt_batch(batch_item *items, size_t count) {
+    sm4_decrypt_batch(items, count);
+  }
+
+  static void hash(const uint8_t *plaintext, int plaintext_len,
+                   uint8_t *digest) {
+    sm3_digest(plaintext, plaintext_len, digest);
+  }
+
+  static void hash_batch(const uint8_t *const *plaintexts,
+                         const int *plaintext_lens, size_t count,
+                         uint8_t *digests) {
+    sm3_digest_batch(plaintexts, plaintext_lens, count, digests);
+  }
+
+  static unsigned int prf(const uint8_t *plaintext, int plaintext_len,
+                          const uint8_t *key, int key_len, uint8_t *digest) {
+    return hmac_digest(plaintext, plaintext_len, key, key_len, digest);
+  }
+
+  static void prf_key_init(prf_key *state, const uint8_t *key, int key_len) {
+    hmac_key_init(state, key, key_len);
+  }
+
+  static unsigned int prf_key_digest(const prf_key *state,
+                                     const uint8_t *plaintext,
+                                     int plaintext_len, uint8_t *digest) {
+    return hmac_key_digest(state, plaintext, plaintext_len, digest);
+  }
+
+  static void prf_key_digest_batch(const prf_key *state,
+                                   const uint8_t *const *plaintexts,
+                                   const int *plaintext_lens, size_t count,
+                                   uint8_t *digests) {
+    hmac_key_digest_batch(state, plaintexts, plaintext_lens, count, digests);
+  }
+
+  static void prf_key_free(prf_key *state) { hmac_key_free(state); }
+
+  static unsigned int kdf(const uint8_t *plaintext, int plaintext_len,
+                          const uint8_t *key, int key_len, uint8_t *digest) {
+    return key_derivation(plaintext, plaintext_len, key, key_len, digest);
+  }
+
+  static void prg_derive(const uint8_t *key, int bit, uint8_t *child) {
+    sm4_key_derivation(key, bit, child);
+  }
+
+  static void prg_derive_batch(uint8_t *const *keys, const int *bits,
+                               size_t count) {
+    sm4_key_derivation_batch(keys, bits, count);
+  }
+};
+
+// AES-128-CTR, SHA-256 and HMAC-SHA256, accelerated by AES-NI and SHA-NI
+struct AESSuite {
+  static constexpr const char *name = "AES";
+  using batch_item = ctr_batch_item;
+  using prf_key = hmac_key;
+
+  static int encrypt(const uint8_t *plaintext, int plaintext_len,
+                     const uint8_t *key, const uint8_t *iv,
+                     uint8_t *ciphertext) {
+    return aes128_encrypt(plaintext, plaintext_len, key, iv, ciphertext);
+  }
+
+  static int decrypt(const uint8_t *ciphertext, int ciphertext_len,
+                     const uint8_t *key, const uint8_t *iv,
+                     uint8_t *plaintext) {
+    return aes128_decrypt(ciphertext, ciphertext_len, key, iv, plaintext);
+  }
+
+  static void encrypt_batch(batch_item *items, size_t count) {
+    aes128_encrypt_batch(items, count);
+  }
+
+  static void decrypt_batch(batch_item *items, size_t count) {
+    aes128_decrypt_batch(items, count);
+  }
+
+  static void hash(const uint8_t *plaintext, int plaintext_len,
+                   uint8_t *digest) {
+    sha256_digest(plaintext, plaintext_len, digest);
+  }
+
+  // SHA-NI already hashes one message at full speed
+  static void hash_batch(const uint8_t *const *plaintexts,
+                         const int *plaintext_lens, size_t count,
+                         uint8_t *digests) {
+    for (size_t i = 0; i < count; ++i) {
+      sha256_digest(plaintexts[i], plaintext_lens[i],
+                    digests + i * DIGEST_SIZE);
+    }
+  }
+
+  static unsigned int prf(const uint8_t *plaintext, int plaintext_len,
+                          const uint8_t *key, int key_len, uint8_t *digest) {
+    return hmac_sha256_digest(plaintext, plaintext_len, key, key_len, digest);
+  }
+
+  static void prf_key_init(prf_key *state, const uint8_t *key, int key_len) {
+    hmac_sha256_key_init(state, key, key_len);
+  }
+
+  static unsigned int prf_key_digest(const prf_key *state,
+                                     const uint8_t *plaintext,
+                                     int plaintext_len, uint8_t *digest) {
+    return hmac_key_digest(state, plaintext, plaintext_len, digest);
+  }
+
+  static void prf_key_digest_batch(const prf_key *state,
+                                   const uint8_t *const *plaintexts,
+                                   const int *plaintext_lens, size_t count,
+                                   uint8_t *digests) {
+    hmac_key_digest_batch(state, plaintexts, plaintext_lens, count, digests);
+  }
+
+  static void prf_key_free(prf_key *state) { hmac_key_free(state); }
+
+  static unsigned int kdf(const uint8_t *plaintext, int plaintext_len,
+                          const uint8_t *key, int key_len, uint8_t *digest) {
+    return sha256_key_derivation(plaintext, plaintext_len, key, key_len,
+                                 digest);
+  }
+
+  static void prg_derive(const uint8_t *key, int bit, uint8_t *child) {
+    aes128_key_derivation(key, bit, child);
+  }
+
+  static void prg_derive_batch(uint8_t *const *keys, const int *bits,
+                               size_t count) {
+    aes128_key_derivation_batch(keys, bits, count);
+  }
+};
+
+#ifdef SDSSE_CRYPTO_AES
+using CryptoSuite = AESSuite;
+#else
+using CryptoSuite = SMSuite;
+#endif
+
+#endif // AURA_CRYPTOSUITE_H
@@ -234,6 +234,13 @@ string G::toString() const {
   return str;
 }
 
+void G::toBytes(unsigned char *data) const {
+  if (elementPresent)
+    element_to_bytes(data, *(element_t *)&g);
+  else
+    throw UndefinedElementException();
+}
+
 // Dump the element to stdout
 void G::dump(FILE *f, const char *label, unsigned short base) const {
   if (label)
@@ -38,6 +38,9 @@ public:
   bool isElementPresent() const { return elementPresent; }
 
   string toString() const;
+  // Write the getElementSize() bytes of toString() to data without
+  // allocating
+  void toBytes(unsigned char *data) const;
 
   // Dump the element to stdout (print friendly)
   void dump(FILE *f, const char *label = NULL, unsigned short base = 16) const;
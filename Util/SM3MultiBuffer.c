@@ -0,0 +1,254 @@
+#include "CommonUtil.h"
+#include <string.h>
+
+/* number of independent messages hashed by one call of the vector kernel */
+#define SM3_LANES 16
+/* below this many messages the scalar compression is cheaper */
+#define SM3_MIN_LANES 4
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define P0(x) ((x) ^ ROTL((x), 9) ^ ROTL((x), 17))
+#define P1(x) ((x) ^ ROTL((x), 15) ^ ROTL((x), 23))
+
+static const uint32_t sm3_iv[8] = {0x7380166f, 0x4914b2b9, 0x172442d7,
+                                   0xda8a0600, 0xa96f30bc, 0x163138aa,
+                                   0xe38dee4d, 0xb0fb0e4e};
+
+/* T_j <<< (j mod 32) */
+static uint32_t round_constant(int j) {
+  uint32_t t = j < 16 ? 0x79cc4519 : 0x7a879d8a;
+  int n = j % 32;
+  return n ? ROTL(t, n) : t;
+}
+
+static uint32_t load_be32(const unsigned char *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         (uint32_t)p[3];
+}
+
+static void store_be32(unsigned char *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void sm3_compress(uint32_t cv[8], const unsigned char block[64]) {
+  uint32_t w[68];
+  for (int j = 0; j < 16; ++j)
+    w[j] = load_be32(block + 4 * j);
+  for (int j = 16; j < 68; ++j)
+    w[j] = P1(w[j - 16] ^ w[j - 9] ^ ROTL(w[j - 3], 15)) ^
+           ROTL(w[j - 13], 7) ^ w[j - 6];
+
+  uint32_t a = cv[0], b = cv[1], c = cv[2], d = cv[3];
+  uint32_t e = cv[4], f = cv[5], g = cv[6], h = cv[7];
+  for (int j = 0; j < 64; ++j) {
+    uint32_t a12 = ROTL(a, 12);
+    uint32_t ss1 = ROTL(a12 + e + round_constant(j), 7);
+    uint32_t ss2 = ss1 ^ a12;
+    uint32_t ff = j < 16 ? a ^ b ^ c : (a & b) | (a & c) | (b & c);
+    uint32_t gg = j < 16 ? e ^ f ^ g : (e & f) | (~e & g);
+    uint32_t tt1 = ff + d + ss2 + (w[j] ^ w[j + 4]);
+    uint32_t tt2 = gg + h + ss1 + w[j];
+    d = c;
+    c = ROTL(b, 9);
+    b = a;
+    a = tt1;
+    h = g;
+    g = ROTL(f, 19);
+    f = e;
+    e = P0(tt2);
+  }
+  cv[0] ^= a;
+  cv[1] ^= b;
+  cv[2] ^= c;
+  cv[3] ^= d;
+  cv[4] ^= e;
+  cv[5] ^= f;
+  cv[6] ^= g;
+  cv[7] ^= h;
+}
+
+/*
+ * The same compression on SM3_LANES independent blocks, one message per
+ * vector lane. The kernel is written once with vector extensions and cloned
+ * for AVX-512, AVX2 and the baseline ISA; the loader picks the clone from
+ * CPUID. Other targets get the portable build of the same code.
+ */
+typedef uint32_t sm3_vec __attribute__((vector_size(4 * SM3_LANES)));
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+static void sm3_compress_lanes(uint32_t cv[8][SM3_LANES],
+                               const unsigned char blocks[SM3_LANES][64]) {
+  sm3_vec w[68];
+  for (int j = 0; j < 16; ++j)
+    for (int l = 0; l < SM3_LANES; ++l)
+      w[j][l] = load_be32(blocks[l] + 4 * j);
+  for (int j = 16; j < 68; ++j)
+    w[j] = P1(w[j - 16] ^ w[j - 9] ^ ROTL(w[j - 3], 15)) ^
+           ROTL(w[j - 13], 7) ^ w[j - 6];
+
+  sm3_vec v[8];
+  memcpy(v, cv, sizeof(v));
+  sm3_vec a = v[0], b = v[1], c = v[2], d = v[3];
+  sm3_vec e = v[4], f = v[5], g = v[6], h = v[7];
+  for (int j = 0; j < 64; ++j) {
+    sm3_vec a12 = ROTL(a, 12);
+    sm3_vec ss1 = ROTL(a12 + e + round_constant(j), 7);
+    sm3_vec ss2 = ss1 ^ a12;
+    sm3_vec ff, gg;
+    if (j < 16) {
+      ff = a ^ b ^ c;
+      gg = e ^ f ^ g;
+    } else {
+      ff = (a & b) | (a & c) | (b & c);
+      gg = (e & f) | (~e & g);
+    }
+    sm3_vec tt1 = ff + d + ss2 + (w[j] ^ w[j + 4]);
+    sm3_vec tt2 = gg + h + ss1 + w[j];
+    d = c;
+    c = ROTL(b, 9);
+    b = a;
+    a = tt1;
+    h = g;
+    g = ROTL(f, 19);
+    f = e;
+    e = P0(tt2);
+  }
+  v[0] ^= a;
+  v[1] ^= b;
+  v[2] ^= c;
+  v[3] ^= d;
+  v[4] ^= e;
+  v[5] ^= f;
+  v[6] ^= g;
+  v[7] ^= h;
+  memcpy(cv, v, sizeof(v));
+}
+
+/* pad a message of at most SM3_SINGLE_BLOCK_MAX bytes into its final block,
+ * prefix_len bytes were already absorbed into the chaining value */
+static void pad_block(unsigned char block[64], const unsigned char *message,
+                      int len, int prefix_len) {
+  uint64_t bits = (uint64_t)(prefix_len + len) * 8;
+  memcpy(block, message, len);
+  block[len] = 0x80;
+  memset(block + len + 1, 0, 64 - 8 - len - 1);
+  store_be32(block + 56, bits >> 32);
+  store_be32(block + 60, (uint32_t)bits);
+}
+
+/* hash n <= SM3_LANES short messages that all start from the chaining value
+ * init_cv, writing the 32-byte digests to outputs */
+static void single_blocks(const uint32_t init_cv[8], int prefix_len,
+                          const unsigned char *const *messages,
+                          const int *lens, unsigned char *const *outputs,
+                          int n) {
+  if (n < SM3_MIN_LANES) {
+    for (int l = 0; l < n; ++l) {
+      unsigned char block[64];
+      uint32_t cv[8];
+      memcpy(cv, init_cv, sizeof(cv));
+      pad_block(block, messages[l], lens[l], prefix_len);
+      sm3_compress(cv, block);
+      for (int i = 0; i < 8; ++i)
+        store_be32(outputs[l] + 4 * i, cv[i]);
+    }
+    return;
+  }
+
+  /* idle lanes hash the first message again, their output is dropped */
+  unsigned char blocks[SM3_LANES][64];
+  uint32_t cv[8][SM3_LANES];
+  for (int l = 0; l < SM3_LANES; ++l) {
+    int src = l < n ? l : 0;
+    pad_block(blocks[l], messages[src], lens[src], prefix_len);
+    for (int i = 0; i < 8; ++i)
+      cv[i][l] = init_cv[i];
+  }
+  sm3_compress_lanes(cv, blocks);
+  for (int l = 0; l < n; ++l)
+    for (int i = 0; i < 8; ++i)
+      store_be32(outputs[l] + 4 * i, cv[i][l]);
+}
+
+void sm3_block_state(const unsigned char block[SM3_BLOCK_SIZE],
+                     uint32_t cv[8]) {
+  memcpy(cv, sm3_iv, sizeof(sm3_iv));
+  sm3_compress(cv, block);
+}
+
+void sm3_digest_batch(const unsigned char *const *plaintexts,
+                      const int *plaintext_lens, size_t count,
+                      unsigned char *digests) {
+  const unsigned char *lane_inputs[SM3_LANES];
+  int lane_lens[SM3_LANES];
+  unsigned char *lane_outputs[SM3_LANES];
+  int n = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    unsigned char *digest = digests + i * DIGEST_SIZE;
+    if (plaintext_lens[i] > SM3_SINGLE_BLOCK_MAX) {
+      sm3_digest(plaintexts[i], plaintext_lens[i], digest);
+      continue;
+    }
+    lane_inputs[n] = plaintexts[i];
+    lane_lens[n] = plaintext_lens[i];
+    lane_outputs[n] = digest;
+    if (++n == SM3_LANES) {
+      single_blocks(sm3_iv, 0, lane_inputs, lane_lens, lane_outputs, n);
+      n = 0;
+    }
+  }
+  if (n)
+    single_blocks(sm3_iv, 0, lane_inputs, lane_lens, lane_outputs, n);
+}
+
+/* HMAC of up to SM3_LANES short messages: both passes are one block each */
+static void hmac_lanes(const hmac_key *state,
+                       const unsigned char *const *messages, const int *lens,
+                       unsigned char *const *outputs, int n) {
+  unsigned char inner_digests[SM3_LANES][DIGEST_SIZE];
+  const unsigned char *inner_inputs[SM3_LANES];
+  unsigned char *inner_outputs[SM3_LANES];
+  int inner_lens[SM3_LANES];
+  for (int l = 0; l < n; ++l) {
+    inner_outputs[l] = inner_digests[l];
+    inner_inputs[l] = inner_digests[l];
+    inner_lens[l] = DIGEST_SIZE;
+  }
+  single_blocks(state->inner_cv, SM3_BLOCK_SIZE, messages, lens,
+                inner_outputs, n);
+  single_blocks(state->outer_cv, SM3_BLOCK_SIZE, inner_inputs, inner_lens,
+                outputs, n);
+}
+
+void hmac_key_digest_batch(const hmac_key *state,
+                           const unsigned char *const *plaintexts,
+                           const int *plaintext_lens, size_t count,
+                           unsigned char *digests) {
+  const unsigned char *lane_inputs[SM3_LANES];
+  int lane_lens[SM3_LANES];
+  unsigned char *lane_outputs[SM3_LANES];
+  int n = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    unsigned char *digest = digests + i * DIGEST_SIZE;
+    if (!state->multi_lane || plaintext_lens[i] > SM3_SINGLE_BLOCK_MAX) {
+      hmac_key_digest(state, plaintexts[i], plaintext_lens[i], digest);
+      continue;
+    }
+    lane_inputs[n] = plaintexts[i];
+    lane_lens[n] = plaintext_lens[i];
+    lane_outputs[n] = digest;
+    if (++n == SM3_LANES) {
+      hmac_lanes(state, lane_inputs, lane_lens, lane_outputs, n);
+      n = 0;
+    }
+  }
+  if (n)
+    hmac_lanes(state, lane_inputs, lane_lens, lane_outputs, n);
+}
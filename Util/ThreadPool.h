@@ -0,0 +1,110 @@
+#ifndef AURA_THREADPOOL_H
+#define AURA_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that split one index range at a time. The
+// caller runs chunks too and parallel_for returns once every chunk is done,
+// so work that writes its results by index keeps a deterministic order. A
+// call made while the pool is busy with another caller runs inline.
+class ThreadPool {
+private:
+  std::vector<std::thread> workers;
+  std::mutex submit_mtx; // one job at a time
+  std::mutex mtx;
+  std::condition_variable job_ready;
+  std::condition_variable job_done;
+  // the running job, f(begin, end) over chunks of [0, job_count)
+  std::function<void(size_t, size_t)> job;
+  size_t job_count = 0;
+  size_t job_chunk = 1;
+  std::atomic<size_t> next_chunk{0};
+  unsigned busy = 0;       // workers that have not finished the job yet
+  uint64_t generation = 0; // bumped for every job
+  bool stopping = false;
+
+  void run_chunks() {
+    size_t chunks = (job_count + job_chunk - 1) / job_chunk;
+    for (size_t c = next_chunk++; c < chunks; c = next_chunk++) {
+      job(c * job_chunk, std::min(job_count, (c + 1) * job_chunk));
+    }
+  }
+
+  void worker_loop() {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        job_ready.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping)
+          return;
+        seen = generation;
+      }
+      run_chunks();
+      std::lock_guard<std::mutex> lock(mtx);
+      if (--busy == 0)
+        job_done.notify_one();
+    }
+  }
+
+public:
+  // threads counts the calling thread, so 1 keeps everything inline
+  explicit ThreadPool(
+      unsigned threads = std::max(1U, std::thread::hardware_concurrency())) {
+    for (unsigned i = 1; i < threads; ++i) {
+      workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stopping = true;
+    }
+    job_ready.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned size() const { return workers.size() + 1; }
+
+  // run f(begin, end) over disjoint chunks of [0, count), each at least
+  // min_chunk long, and wait for all of them
+  void parallel_for(size_t count, size_t min_chunk,
+                    const std::function<void(size_t, size_t)> &f) {
+    std::unique_lock<std::mutex> submit(submit_mtx, std::try_to_lock);
+    if (workers.empty() || count <= min_chunk || !submit) {
+      if (count > 0)
+        f(0, count);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      job = f;
+      job_count = count;
+      // a few chunks per thread so that uneven chunks still balance
+      job_chunk = std::max(min_chunk, (count + 4 * size() - 1) / (4 * size()));
+      next_chunk = 0;
+      busy = workers.size();
+      ++generation;
+    }
+    job_ready.notify_all();
+    run_chunks();
+    std::unique_lock<std::mutex> lock(mtx);
+    job_done.wait(lock, [&] { return busy == 0; });
+  }
+};
+
+#endif // AURA_THREADPOOL_H